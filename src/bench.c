@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <SDL2/SDL.h>
+#include "bench.h"
+#include "display.h"
+#include "mesh.h"
+#include "texture.h"
+#include "array.h"
+#include "profile.h"
+#include "matrix.h"
+#include "span.h"
+
+typedef struct {
+    char* name;
+    char* obj_filename;
+    char* png_filename;
+} bench_model_t;
+
+static bench_model_t bench_models[] = {
+    { "cube",   "./assets/cube.obj",   "./assets/cube.png" },
+    { "f22",    "./assets/f22.obj",    "./assets/f22.png" },
+    { "f117",   "./assets/f117.obj",   "./assets/f117.png" },
+    { "efa",    "./assets/efa.obj",    "./assets/efa.png" },
+    { "crab",   "./assets/crab.obj",   "./assets/crab.png" },
+    { "drone",  "./assets/drone.obj",  "./assets/drone.png" },
+    // There is no sphere.png, the sphere gets the pikuma logo as its texture
+    { "sphere", "./assets/sphere.obj", "./assets/pikuma.png" }
+};
+
+#define N_BENCH_MODELS ((int)(sizeof(bench_models) / sizeof(bench_models[0])))
+
+// Indexed by enum render_method
+static char* render_method_names[] = {
+    "wire",
+    "wire_vertex",
+    "fill_triangle",
+    "fill_triangle_wire",
+    "textured",
+    "textured_wire"
+};
+
+#define N_RENDER_METHODS ((int)(sizeof(render_method_names) / sizeof(render_method_names[0])))
+
+typedef struct {
+    char model[32];
+    char method[32];
+    int frames;
+    double seconds;
+    double update_ms;    // average time spent in update() per frame
+    double render_ms;    // average time spent in render() per frame
+    double fps;
+    double triangles_per_second;
+    double pixels_per_second;
+} bench_result_t;
+
+static double ticks_to_seconds(uint64_t ticks) {
+    return (double)ticks / (double)SDL_GetPerformanceFrequency();
+}
+
+// Render the loaded mesh for a number of frames, always starting from the same pose
+static bench_result_t bench_render_method(const char* model, int method, int frames, void (*update_frame)(void), void (*render_frame)(void)) {
+    bench_result_t result;
+    memset(&result, 0, sizeof(result));
+    snprintf(result.model, sizeof(result.model), "%s", model);
+    snprintf(result.method, sizeof(result.method), "%s", render_method_names[method]);
+    result.frames = frames;
+
+    render_method = method;
+    transform_set_rotation(&mesh.transform, (vec3_t){ 0, 0, 0 });
+    clear_color_buffer(0xFF000000);
+
+    uint64_t update_ticks = 0;
+    uint64_t render_ticks = 0;
+    uint64_t triangles = 0;
+    uint64_t pixels = 0;
+
+    for (int i = 0; i < frames; i++) {
+        frame_stats.triangles = 0;
+        frame_stats.pixels = 0;
+
+        PROFILE_FRAME_BEGIN();
+        uint64_t start = SDL_GetPerformanceCounter();
+        update_frame();
+        uint64_t updated = SDL_GetPerformanceCounter();
+        render_frame();
+        uint64_t rendered = SDL_GetPerformanceCounter();
+        PROFILE_FRAME_END();
+
+        update_ticks += updated - start;
+        render_ticks += rendered - updated;
+        triangles += frame_stats.triangles;
+        pixels += frame_stats.pixels;
+    }
+
+    result.seconds = ticks_to_seconds(update_ticks + render_ticks);
+    if (frames > 0 && result.seconds > 0) {
+        result.update_ms = ticks_to_seconds(update_ticks) * 1000.0 / frames;
+        result.render_ms = ticks_to_seconds(render_ticks) * 1000.0 / frames;
+        result.fps = frames / result.seconds;
+        result.triangles_per_second = triangles / result.seconds;
+        result.pixels_per_second = pixels / result.seconds;
+    }
+    return result;
+}
+
+static bool write_csv(const char* filename, const bench_result_t* results, int num_results) {
+    FILE* file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "Error opening %s for writing.\n", filename);
+        return false;
+    }
+    fprintf(file, "model,render_method,frames,seconds,update_ms,render_ms,fps,triangles_per_second,pixels_per_second\n");
+    for (int i = 0; i < num_results; i++) {
+        const bench_result_t* r = &results[i];
+        fprintf(file, "%s,%s,%d,%.6f,%.6f,%.6f,%.3f,%.1f,%.1f\n",
+            r->model, r->method, r->frames, r->seconds, r->update_ms, r->render_ms,
+            r->fps, r->triangles_per_second, r->pixels_per_second
+        );
+    }
+    return fclose(file) == 0;
+}
+
+static bool write_json(const char* filename, const bench_result_t* results, int num_results) {
+    FILE* file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "Error opening %s for writing.\n", filename);
+        return false;
+    }
+    fprintf(file, "{\n  \"width\": %d,\n  \"height\": %d,\n  \"results\": [\n", window_width, window_height);
+    for (int i = 0; i < num_results; i++) {
+        const bench_result_t* r = &results[i];
+        fprintf(file,
+            "    { \"model\": \"%s\", \"render_method\": \"%s\", \"frames\": %d, \"seconds\": %.6f, "
+            "\"update_ms\": %.6f, \"render_ms\": %.6f, \"fps\": %.3f, "
+            "\"triangles_per_second\": %.1f, \"pixels_per_second\": %.1f }%s\n",
+            r->model, r->method, r->frames, r->seconds, r->update_ms, r->render_ms,
+            r->fps, r->triangles_per_second, r->pixels_per_second,
+            (i + 1 < num_results) ? "," : ""
+        );
+    }
+    fprintf(file, "  ]\n}\n");
+    return fclose(file) == 0;
+}
+
+// Compare the fps of every result with the same model and render method in a baseline CSV
+static bool compare_baseline(const char* filename, const bench_result_t* results, int num_results, float tolerance, bool allow_missing) {
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error opening baseline %s.\n", filename);
+        return false;
+    }
+
+    printf("\nComparing against %s (tolerance %.1f%%)\n", filename, tolerance * 100.0);
+
+    bool passed = true;
+    bool compared[N_BENCH_MODELS * N_RENDER_METHODS] = { false };
+    int num_missing = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        bench_result_t base;
+        int fields = sscanf(line, "%31[^,],%31[^,],%d,%lf,%lf,%lf,%lf",
+            base.model, base.method, &base.frames, &base.seconds, &base.update_ms, &base.render_ms, &base.fps
+        );
+        // Skips the header and anything malformed
+        if (fields != 7 || base.fps <= 0) {
+            continue;
+        }
+        bool found = false;
+        for (int i = 0; i < num_results; i++) {
+            const bench_result_t* r = &results[i];
+            if (strcmp(r->model, base.model) != 0 || strcmp(r->method, base.method) != 0) {
+                continue;
+            }
+            found = true;
+            compared[i] = true;
+            double change = (r->fps - base.fps) / base.fps;
+            char* verdict = "ok";
+            if (change < -tolerance) {
+                verdict = "SLOWER";
+                passed = false;
+            } else if (change > tolerance) {
+                verdict = "faster";
+            }
+            printf("%-8s %-20s %10.1f fps vs %10.1f fps  %+7.1f%%  %s\n",
+                r->model, r->method, r->fps, base.fps, change * 100.0, verdict
+            );
+        }
+        if (!found) {
+            printf("%-8s %-20s in the baseline but not in this run\n", base.model, base.method);
+            num_missing++;
+        }
+    }
+    fclose(file);
+
+    // A renamed model or render method would otherwise pass without being compared
+    for (int i = 0; i < num_results; i++) {
+        if (!compared[i]) {
+            printf("%-8s %-20s missing from the baseline\n", results[i].model, results[i].method);
+            num_missing++;
+        }
+    }
+    if (num_missing > 0 && !allow_missing) {
+        fprintf(stderr, "%d results could not be compared against %s.\n", num_missing, filename);
+        passed = false;
+    }
+    return passed;
+}
+
+bool run_benchmark(const bench_options_t* options, void (*update_frame)(void), void (*render_frame)(void)) {
+    bool passed = true;
+    bool capped = frame_rate_capped;
+    frame_rate_capped = false;
+
+    bench_result_t results[N_BENCH_MODELS * N_RENDER_METHODS];
+    int num_results = 0;
+
+    printf("Benchmark: %d frames per run at %dx%d, %s textured spans\n\n", options->frames, window_width, window_height, span_kernel_name);
+    printf("%-8s %-20s %10s %12s %14s %10s %10s\n", "model", "render_method", "fps", "tris/s", "pixels/s", "update ms", "render ms");
+
+    for (int m = 0; m < N_BENCH_MODELS; m++) {
+        free_mesh_data();
+        free_png_texture_data();
+        if (!load_obj_file_data(bench_models[m].obj_filename)) {
+            passed = false;
+            continue;
+        }
+        if (!load_png_texture_data(bench_models[m].png_filename)) {
+            fprintf(stderr, "Error loading %s.\n", bench_models[m].png_filename);
+            passed = false;
+            continue;
+        }
+
+        for (int method = 0; method < N_RENDER_METHODS; method++) {
+            bench_result_t r = bench_render_method(bench_models[m].name, method, options->frames, update_frame, render_frame);
+            printf("%-8s %-20s %10.1f %12.0f %14.0f %10.3f %10.3f\n",
+                r.model, r.method, r.fps, r.triangles_per_second, r.pixels_per_second, r.update_ms, r.render_ms
+            );
+            results[num_results++] = r;
+        }
+    }
+
+    if (options->csv_filename != NULL && !write_csv(options->csv_filename, results, num_results)) {
+        passed = false;
+    }
+    if (options->json_filename != NULL && !write_json(options->json_filename, results, num_results)) {
+        passed = false;
+    }
+    if (options->baseline_filename != NULL && !compare_baseline(options->baseline_filename, results, num_results, options->tolerance, options->allow_missing)) {
+        passed = false;
+    }
+
+    frame_rate_capped = capped;
+    return passed;
+}
+
+bool run_vertex_benchmark(int iterations) {
+    free_mesh_data();
+    if (!load_obj_file_data("./assets/drone.obj")) {
+        return false;
+    }
+    int num_vertices = array_length(mesh.vertices);
+    vec4_t* transformed = (vec4_t*) malloc(sizeof(vec4_t) * num_vertices);
+    vec4_t* projected = (vec4_t*) malloc(sizeof(vec4_t) * num_vertices);
+    vec4_t* batch_transformed = (vec4_t*) malloc(sizeof(vec4_t) * num_vertices);
+    vec4_t* batch_projected = (vec4_t*) malloc(sizeof(vec4_t) * num_vertices);
+
+    transform_set_rotation(&mesh.transform, (vec3_t){ 0.3, 0.6, 0.1 });
+    transform_set_translation(&mesh.transform, (vec3_t){ 0, 0, 5.0 });
+    mat4_t world_matrix = *transform_get_world_matrix(&mesh.transform);
+    mat4_t proj_matrix = mat4_make_perspective(M_PI / 3.0, (float)window_height / (float)window_width, 0.1, 100.0);
+
+    // The scalar path as the pipeline used to run it, one vertex at a time
+    uint64_t start = SDL_GetPerformanceCounter();
+    for (int n = 0; n < iterations; n++) {
+        for (int i = 0; i < num_vertices; i++) {
+            transformed[i] = mat4_mul_vec4(world_matrix, vec4_from_vec3(mesh.vertices[i]));
+            vec4_t projected_point = mat4_mul_vec4_project(proj_matrix, transformed[i]);
+            projected_point.y *= -1;
+            projected_point.x *= (window_width / 2.0);
+            projected_point.y *= (window_height / 2.0);
+            projected_point.x += (window_width / 2.0);
+            projected_point.y += (window_height / 2.0);
+            projected[i] = projected_point;
+        }
+    }
+    double scalar_seconds = ticks_to_seconds(SDL_GetPerformanceCounter() - start);
+
+    start = SDL_GetPerformanceCounter();
+    for (int n = 0; n < iterations; n++) {
+        mat4_mul_vec3_batch(&world_matrix, mesh.vertices, batch_transformed, num_vertices);
+        mat4_project_to_screen_batch(&proj_matrix, batch_transformed, batch_projected, NULL, num_vertices, window_width, window_height);
+    }
+    double batch_seconds = ticks_to_seconds(SDL_GetPerformanceCounter() - start);
+
+    // The same kernels reading the structure-of-arrays positions built at load
+    vec4_t* soa_transformed = (vec4_t*) malloc(sizeof(vec4_t) * num_vertices);
+    start = SDL_GetPerformanceCounter();
+    for (int n = 0; n < iterations; n++) {
+        mat4_mul_soa_batch(&world_matrix, mesh.soa.x, mesh.soa.y, mesh.soa.z, soa_transformed, num_vertices);
+        mat4_project_to_screen_batch(&proj_matrix, soa_transformed, batch_projected, NULL, num_vertices, window_width, window_height);
+    }
+    double soa_seconds = ticks_to_seconds(SDL_GetPerformanceCounter() - start);
+
+    // The compiler may keep the scalar viewport math in double precision, so allow a rounding step
+    float max_difference = 0;
+    for (int i = 0; i < num_vertices; i++) {
+        const float* a = (const float*)&transformed[i];
+        const float* b = (const float*)&batch_transformed[i];
+        const float* c = (const float*)&projected[i];
+        const float* d = (const float*)&batch_projected[i];
+        const float* e = (const float*)&soa_transformed[i];
+        for (int k = 0; k < 4; k++) {
+            max_difference = fmaxf(max_difference, fabsf(a[k] - b[k]));
+            max_difference = fmaxf(max_difference, fabsf(a[k] - e[k]));
+            max_difference = fmaxf(max_difference, fabsf(c[k] - d[k]));
+        }
+    }
+
+#if defined(__AVX2__)
+    const char* kernel = "AVX2";
+#elif defined(__SSE2__)
+    const char* kernel = "SSE2";
+#else
+    const char* kernel = "scalar";
+#endif
+    double vertices = (double)num_vertices * iterations;
+    printf("Vertex transform + projection, drone.obj (%d vertices) x %d iterations\n", num_vertices, iterations);
+    printf("%-8s %10.2f ns/vertex %10.1f Mvertices/s\n", "scalar", scalar_seconds * 1e9 / vertices, vertices / scalar_seconds / 1e6);
+    printf("%-8s %10.2f ns/vertex %10.1f Mvertices/s  %.2fx\n", kernel, batch_seconds * 1e9 / vertices, vertices / batch_seconds / 1e6, scalar_seconds / batch_seconds);
+    printf("%-8s %10.2f ns/vertex %10.1f Mvertices/s  %.2fx\n", "SoA", soa_seconds * 1e9 / vertices, vertices / soa_seconds / 1e6, scalar_seconds / soa_seconds);
+    printf("largest difference from the scalar path: %g\n", max_difference);
+
+    free(transformed);
+    free(projected);
+    free(batch_transformed);
+    free(batch_projected);
+    free(soa_transformed);
+    return max_difference < 0.001;
+}
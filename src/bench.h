@@ -0,0 +1,24 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+
+typedef struct {
+    int frames;                   // frames rendered per model and render method
+    const char* csv_filename;     // results as CSV, NULL to skip
+    const char* json_filename;    // results as JSON, NULL to skip
+    const char* baseline_filename; // CSV from a previous run to compare against, NULL to skip
+    float tolerance;              // allowed relative fps change before it is reported, e.g. 0.1
+    bool allow_missing;           // pass when results and baseline entries do not all match up
+} bench_options_t;
+
+// Renders every bundled model with every render method along a fixed rotation path
+// and returns false when any result is slower than the baseline beyond the tolerance, or when
+// a result and a baseline entry have no match and allow_missing is not set
+bool run_benchmark(const bench_options_t* options, void (*update_frame)(void), void (*render_frame)(void));
+
+// Times the scalar per-vertex transform and projection against the batch kernels on the
+// largest model and returns false when their results differ
+bool run_vertex_benchmark(int iterations);
+
+#endif
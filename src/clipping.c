@@ -0,0 +1,216 @@
+#include <math.h>
+#include "clipping.h"
+
+static plane_t make_plane(float a, float b, float c, float d) {
+    float length = sqrtf(a * a + b * b + c * c);
+    plane_t plane = { { a / length, b / length, c / length }, d / length };
+    return plane;
+}
+
+// Extract the frustum planes in view space from the rows of the projection matrix
+// (Gribb and Hartmann). The near plane is z = 0 in clip space, like in clip_polygon.
+void init_frustum_planes(const mat4_t* proj_matrix, plane_t planes[NUM_FRUSTUM_PLANES]) {
+    const float (*m)[4] = proj_matrix->m;
+    planes[FRUSTUM_LEFT] = make_plane(m[3][0] + m[0][0], m[3][1] + m[0][1], m[3][2] + m[0][2], m[3][3] + m[0][3]);
+    planes[FRUSTUM_RIGHT] = make_plane(m[3][0] - m[0][0], m[3][1] - m[0][1], m[3][2] - m[0][2], m[3][3] - m[0][3]);
+    planes[FRUSTUM_TOP] = make_plane(m[3][0] - m[1][0], m[3][1] - m[1][1], m[3][2] - m[1][2], m[3][3] - m[1][3]);
+    planes[FRUSTUM_BOTTOM] = make_plane(m[3][0] + m[1][0], m[3][1] + m[1][1], m[3][2] + m[1][2], m[3][3] + m[1][3]);
+    planes[FRUSTUM_NEAR] = make_plane(m[2][0], m[2][1], m[2][2], m[2][3]);
+    planes[FRUSTUM_FAR] = make_plane(m[3][0] - m[2][0], m[3][1] - m[2][1], m[3][2] - m[2][2], m[3][3] - m[2][3]);
+}
+
+// True when the sphere lies completely on the outer side of one of the planes
+bool is_sphere_outside_frustum(const plane_t planes[NUM_FRUSTUM_PLANES], vec3_t center, float radius) {
+    for (int i = 0; i < NUM_FRUSTUM_PLANES; i++) {
+        if (vec3_dot(planes[i].normal, center) + planes[i].distance < -radius) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Same test for an object space box placed by the world matrix. The box extent along each plane
+// normal is the sum of its half sizes projected on the transformed axes.
+bool is_box_outside_frustum(const plane_t planes[NUM_FRUSTUM_PLANES], const mat4_t* world_matrix, vec3_t min, vec3_t max) {
+    vec4_t center = mat4_mul_vec4(*world_matrix, (vec4_t){ (min.x + max.x) * 0.5, (min.y + max.y) * 0.5, (min.z + max.z) * 0.5, 1.0 });
+    vec3_t half_size = vec3_mul(vec3_sub(max, min), 0.5);
+    for (int i = 0; i < NUM_FRUSTUM_PLANES; i++) {
+        vec3_t n = planes[i].normal;
+        const float (*m)[4] = world_matrix->m;
+        float extent =
+            fabsf(n.x * m[0][0] + n.y * m[1][0] + n.z * m[2][0]) * half_size.x +
+            fabsf(n.x * m[0][1] + n.y * m[1][1] + n.z * m[2][1]) * half_size.y +
+            fabsf(n.x * m[0][2] + n.y * m[1][2] + n.z * m[2][2]) * half_size.z;
+        if (n.x * center.x + n.y * center.y + n.z * center.z + planes[i].distance < -extent) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Signed distance of a clip space vertex to each plane, positive on the inside
+static float plane_distance(vec4_t v, uint16_t plane) {
+    switch (plane) {
+        case CLIP_NEAR: return v.z;
+        case CLIP_GUARD_LEFT: return v.x + CLIP_GUARD_BAND * v.w;
+        case CLIP_GUARD_RIGHT: return CLIP_GUARD_BAND * v.w - v.x;
+        case CLIP_GUARD_TOP: return CLIP_GUARD_BAND * v.w - v.y;
+        case CLIP_GUARD_BOTTOM: return v.y + CLIP_GUARD_BAND * v.w;
+        case CLIP_VIEW_LEFT: return v.x + v.w;
+        case CLIP_VIEW_RIGHT: return v.w - v.x;
+        case CLIP_VIEW_TOP: return v.w - v.y;
+        case CLIP_VIEW_BOTTOM: return v.y + v.w;
+    }
+    return 0;
+}
+
+// Classify every vertex once per frame, so most triangles are accepted or rejected with two bit tests
+void compute_outcodes(const vec4_t* clip, uint16_t* outcodes, int count) {
+    for (int i = 0; i < count; i++) {
+        vec4_t v = clip[i];
+        float guard_w = CLIP_GUARD_BAND * v.w;
+        outcodes[i] =
+            (v.z < 0 ? CLIP_NEAR : 0) |
+            (v.x < -guard_w ? CLIP_GUARD_LEFT : 0) |
+            (v.x > guard_w ? CLIP_GUARD_RIGHT : 0) |
+            (v.y > guard_w ? CLIP_GUARD_TOP : 0) |
+            (v.y < -guard_w ? CLIP_GUARD_BOTTOM : 0) |
+            (v.x < -v.w ? CLIP_VIEW_LEFT : 0) |
+            (v.x > v.w ? CLIP_VIEW_RIGHT : 0) |
+            (v.y > v.w ? CLIP_VIEW_TOP : 0) |
+            (v.y < -v.w ? CLIP_VIEW_BOTTOM : 0);
+    }
+}
+
+polygon_t polygon_from_triangle(vec4_t v0, vec4_t v1, vec4_t v2, tex2_t t0, tex2_t t1, tex2_t t2, const float intensities[3]) {
+    polygon_t polygon = {
+        .vertices = { v0, v1, v2 },
+        .texcoords = { t0, t1, t2 },
+        .intensities = { intensities[0], intensities[1], intensities[2] },
+        .num_vertices = 3
+    };
+    return polygon;
+}
+
+static float lerp(float a, float b, float t) {
+    return a + (b - a) * t;
+}
+
+// Sutherland-Hodgman against a single plane. Interpolating before the divide keeps the texture
+// coordinates and the intensities perspective correct.
+static void clip_polygon_against_plane(polygon_t* polygon, uint16_t plane) {
+    vec4_t inside_vertices[MAX_NUM_POLY_VERTICES];
+    tex2_t inside_texcoords[MAX_NUM_POLY_VERTICES];
+    float inside_intensities[MAX_NUM_POLY_VERTICES];
+    int num_inside = 0;
+
+    int previous = polygon->num_vertices - 1;
+    float previous_distance = plane_distance(polygon->vertices[previous], plane);
+    for (int current = 0; current < polygon->num_vertices; current++) {
+        float current_distance = plane_distance(polygon->vertices[current], plane);
+
+        // The edge crosses the plane, add the intersection point
+        if ((current_distance < 0) != (previous_distance < 0)) {
+            float t = previous_distance / (previous_distance - current_distance);
+            vec4_t a = polygon->vertices[previous];
+            vec4_t b = polygon->vertices[current];
+            tex2_t ta = polygon->texcoords[previous];
+            tex2_t tb = polygon->texcoords[current];
+            inside_vertices[num_inside] = (vec4_t){ lerp(a.x, b.x, t), lerp(a.y, b.y, t), lerp(a.z, b.z, t), lerp(a.w, b.w, t) };
+            inside_texcoords[num_inside] = (tex2_t){ lerp(ta.u, tb.u, t), lerp(ta.v, tb.v, t) };
+            inside_intensities[num_inside] = lerp(polygon->intensities[previous], polygon->intensities[current], t);
+            num_inside++;
+        }
+        if (current_distance >= 0) {
+            inside_vertices[num_inside] = polygon->vertices[current];
+            inside_texcoords[num_inside] = polygon->texcoords[current];
+            inside_intensities[num_inside] = polygon->intensities[current];
+            num_inside++;
+        }
+        previous = current;
+        previous_distance = current_distance;
+    }
+
+    for (int i = 0; i < num_inside; i++) {
+        polygon->vertices[i] = inside_vertices[i];
+        polygon->texcoords[i] = inside_texcoords[i];
+        polygon->intensities[i] = inside_intensities[i];
+    }
+    polygon->num_vertices = num_inside;
+}
+
+// Clip against the planes set in the mask, usually the OR of the outcodes of the vertices
+void clip_polygon(polygon_t* polygon, uint16_t planes) {
+    for (uint16_t plane = CLIP_NEAR; plane <= CLIP_GUARD_BOTTOM; plane <<= 1) {
+        if ((planes & plane) && polygon->num_vertices > 0) {
+            clip_polygon_against_plane(polygon, plane);
+        }
+    }
+}
+
+// Clip the segment from a to b against the planes set in the mask, like clip_polygon does for the
+// wireframe edges. Returns false when no part of it is left.
+bool clip_segment(vec4_t* a, vec4_t* b, uint16_t planes) {
+    float t_start = 0;
+    float t_end = 1;
+    for (uint16_t plane = CLIP_NEAR; plane <= CLIP_GUARD_BOTTOM; plane <<= 1) {
+        if (!(planes & plane)) {
+            continue;
+        }
+        float a_distance = plane_distance(*a, plane);
+        float b_distance = plane_distance(*b, plane);
+        if (a_distance < 0 && b_distance < 0) {
+            return false;
+        }
+        if (a_distance < 0) {
+            t_start = fmaxf(t_start, a_distance / (a_distance - b_distance));
+        } else if (b_distance < 0) {
+            t_end = fminf(t_end, a_distance / (a_distance - b_distance));
+        }
+    }
+    if (t_start > t_end) {
+        return false;
+    }
+    vec4_t start = *a;
+    vec4_t end = *b;
+    *a = (vec4_t){ lerp(start.x, end.x, t_start), lerp(start.y, end.y, t_start), lerp(start.z, end.z, t_start), lerp(start.w, end.w, t_start) };
+    *b = (vec4_t){ lerp(start.x, end.x, t_end), lerp(start.y, end.y, t_end), lerp(start.z, end.z, t_end), lerp(start.w, end.w, t_end) };
+    return true;
+}
+
+// Divide a clip space vertex by w and map it to the viewport, keeping w for the rasterizer
+vec4_t clip_to_screen(vec4_t v, int width, int height) {
+    float half_width = width / 2.0;
+    float half_height = height / 2.0;
+    vec4_t screen = {
+        (v.x / v.w) * half_width + half_width,
+        (v.y / v.w) * -half_height + half_height,
+        v.z / v.w,
+        v.w
+    };
+    return screen;
+}
+
+// Divide the clipped vertices by w, map them to the viewport and split the polygon into a fan of
+// triangles. Returns the number of triangles written, at most MAX_NUM_POLY_VERTICES - 2.
+int triangles_from_polygon(const polygon_t* polygon, triangle_t* triangles, int width, int height) {
+    vec4_t screen[MAX_NUM_POLY_VERTICES];
+    for (int i = 0; i < polygon->num_vertices; i++) {
+        screen[i] = clip_to_screen(polygon->vertices[i], width, height);
+    }
+
+    int num_triangles = 0;
+    for (int i = 1; i + 1 < polygon->num_vertices; i++) {
+        triangle_t* triangle = &triangles[num_triangles++];
+        triangle->points[0] = screen[0];
+        triangle->points[1] = screen[i];
+        triangle->points[2] = screen[i + 1];
+        triangle->texcoords[0] = polygon->texcoords[0];
+        triangle->texcoords[1] = polygon->texcoords[i];
+        triangle->texcoords[2] = polygon->texcoords[i + 1];
+        triangle->intensities[0] = polygon->intensities[0];
+        triangle->intensities[1] = polygon->intensities[i];
+        triangle->intensities[2] = polygon->intensities[i + 1];
+    }
+    return num_triangles;
+}
@@ -0,0 +1,78 @@
+#ifndef CLIPPING_H
+#define CLIPPING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vector.h"
+#include "matrix.h"
+#include "texture.h"
+#include "triangle.h"
+
+// A triangle clipped against the 5 planes gains at most one vertex per plane
+#define MAX_NUM_POLY_VERTICES 8
+
+// How far the guard band reaches past the viewport, in multiples of its half size (NDC units).
+// Triangles that stay inside it are rasterized as they are, only the ones crossing it get clipped.
+#define CLIP_GUARD_BAND 1.25
+
+// Outcode bits of a clip space vertex: which planes it lies outside of
+enum clip_plane {
+    CLIP_NEAR = 1 << 0,
+    CLIP_GUARD_LEFT = 1 << 1,
+    CLIP_GUARD_RIGHT = 1 << 2,
+    CLIP_GUARD_TOP = 1 << 3,
+    CLIP_GUARD_BOTTOM = 1 << 4,
+    CLIP_VIEW_LEFT = 1 << 5,
+    CLIP_VIEW_RIGHT = 1 << 6,
+    CLIP_VIEW_TOP = 1 << 7,
+    CLIP_VIEW_BOTTOM = 1 << 8
+};
+
+// Planes a triangle has to be clipped against when one of its vertices is outside
+#define CLIP_PLANES_MASK (CLIP_NEAR | CLIP_GUARD_LEFT | CLIP_GUARD_RIGHT | CLIP_GUARD_TOP | CLIP_GUARD_BOTTOM)
+// A triangle with all vertices outside one of these planes can't cover any pixel
+#define CLIP_REJECT_MASK (CLIP_NEAR | CLIP_VIEW_LEFT | CLIP_VIEW_RIGHT | CLIP_VIEW_TOP | CLIP_VIEW_BOTTOM)
+
+// Polygon in homogeneous clip space, before the perspective divide
+typedef struct {
+    vec4_t vertices[MAX_NUM_POLY_VERTICES];
+    tex2_t texcoords[MAX_NUM_POLY_VERTICES];
+    float intensities[MAX_NUM_POLY_VERTICES];
+    int num_vertices;
+} polygon_t;
+
+// Plane with the normal pointing inside the frustum, dot(normal, p) + distance >= 0 inside
+typedef struct {
+    vec3_t normal;
+    float distance;
+} plane_t;
+
+enum frustum_plane {
+    FRUSTUM_LEFT,
+    FRUSTUM_RIGHT,
+    FRUSTUM_TOP,
+    FRUSTUM_BOTTOM,
+    FRUSTUM_NEAR,
+    FRUSTUM_FAR,
+    NUM_FRUSTUM_PLANES
+};
+
+void init_frustum_planes(const mat4_t* proj_matrix, plane_t planes[NUM_FRUSTUM_PLANES]);
+
+bool is_sphere_outside_frustum(const plane_t planes[NUM_FRUSTUM_PLANES], vec3_t center, float radius);
+
+bool is_box_outside_frustum(const plane_t planes[NUM_FRUSTUM_PLANES], const mat4_t* world_matrix, vec3_t min, vec3_t max);
+
+void compute_outcodes(const vec4_t* clip, uint16_t* outcodes, int count);
+
+polygon_t polygon_from_triangle(vec4_t v0, vec4_t v1, vec4_t v2, tex2_t t0, tex2_t t1, tex2_t t2, const float intensities[3]);
+
+void clip_polygon(polygon_t* polygon, uint16_t planes);
+
+bool clip_segment(vec4_t* a, vec4_t* b, uint16_t planes);
+
+vec4_t clip_to_screen(vec4_t v, int width, int height);
+
+int triangles_from_polygon(const polygon_t* polygon, triangle_t* triangles, int width, int height);
+
+#endif
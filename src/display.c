@@ -1,14 +1,54 @@
+#include <string.h>
 #include "display.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
+
+enum cull_method cull_method = CULL_BACKFACE;
+enum render_method render_method = RENDER_TEXTURED;
+enum depth_method depth_method = DEPTH_PAINTER;
+enum texture_method texture_method = TEXTURE_PERSPECTIVE;
+enum texture_filter texture_filter = FILTER_NEAREST;
+enum shading_method shading_method = SHADING_FLAT;
+enum background_method background_method = BACKGROUND_SOLID;
+enum clear_method clear_method = CLEAR_FULL;
+enum display_backend display_backend = DISPLAY_WINDOW;
+
+// Wait for FRAME_TARGET_TIME every frame, turned off to measure raw throughput
+bool frame_rate_capped = true;
+
+// Threads rasterizing the screen tiles, 0 uses one per CPU core and 1 draws without binning
+int render_threads = 0;
+frame_stats_t frame_stats = { 0, 0 };
+
 SDL_Window* window = NULL;
 SDL_Renderer* renderer = NULL;
 uint32_t* color_buffer = NULL;
+float* z_buffer = NULL;
 SDL_Texture* color_buffer_texture = NULL;
 int window_width = 800;
 int window_height = 600;
 
+// Prebuilt background the grid clears copy from, and what the color buffer was last cleared to
+static uint32_t* background_layer = NULL;
+static uint32_t background_layer_color = 0;
+static bool color_buffer_cleared = false;
+static enum background_method cleared_background = BACKGROUND_SOLID;
+static uint32_t cleared_color = 0;
+
+// Inclusive pixel bounds of everything drawn since reset_dirty_rect, empty when x_min > x_max
+static int dirty_x_min = 0;
+static int dirty_y_min = 0;
+static int dirty_x_max = -1;
+static int dirty_y_max = -1;
+
+// Headless frames go to <prefix>0000.ppm, <prefix>0001.ppm, ... or are discarded when NULL
+static const char* headless_output_prefix = NULL;
+static int headless_frame_count = 0;
+
 bool initialize_window(void) {
 	if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
 		fprintf(stderr, "Error initializing SDL.\n");
@@ -47,58 +87,350 @@ bool initialize_window(void) {
 	return true;
 }
 
-void draw_grid(void) {
-    for (int y = 0; y < window_height; y++) {
+bool initialize_headless(int width, int height, const char* output_prefix) {
+    if (width <= 0 || height <= 0) {
+        fprintf(stderr, "Invalid headless resolution %dx%d.\n", width, height);
+        return false;
+    }
+    // Only the timer is needed, there is no video device, window or renderer
+    if (SDL_Init(SDL_INIT_TIMER) != 0) {
+        fprintf(stderr, "Error initializing SDL.\n");
+        return false;
+    }
+    display_backend = DISPLAY_HEADLESS;
+    window_width = width;
+    window_height = height;
+    headless_output_prefix = output_prefix;
+    headless_frame_count = 0;
+    return true;
+}
+
+bool create_color_buffer(void) {
+    // Alloc the memory in bytes to hold the color buffer
+    color_buffer = (uint32_t*) malloc(sizeof(uint32_t) * window_width * window_height);
+    // The z-buffer holds 1 - 1/w of the closest pixel drawn so far, 1.0 is infinitely far
+    z_buffer = (float*) malloc(sizeof(float) * window_width * window_height);
+    if (!color_buffer || !z_buffer) {
+        fprintf(stderr, "Error allocating the color buffer.\n");
+        return false;
+    }
+    mark_dirty_rect(0, 0, window_width - 1, window_height - 1);
+    clear_color_buffer(0xFF000000);
+    clear_z_buffer();
+    if (display_backend == DISPLAY_HEADLESS) {
+        return true;
+    }
+    // Creating a SDL texture that is used to display the color
+    color_buffer_texture = SDL_CreateTexture(
+        renderer,
+        //SDL_PIXELFORMAT_ARGB8888,
+        SDL_PIXELFORMAT_RGBA32,
+        SDL_TEXTUREACCESS_STREAMING,
+        window_width,
+        window_height
+    );
+    if (!color_buffer_texture) {
+        fprintf(stderr, "Error creating the color buffer texture.\n");
+        return false;
+    }
+    return true;
+}
+
+// Write the color buffer as a binary PPM, the pixels are RGBA32 so the bytes are already R, G, B, A
+bool write_color_buffer_ppm(const char* filename) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        fprintf(stderr, "Error opening %s for writing.\n", filename);
+        return false;
+    }
+    uint8_t* row = (uint8_t*) malloc(window_width * 3);
+    if (!row) {
+        fclose(file);
+        return false;
+    }
+    bool written = fprintf(file, "P6\n%d %d\n255\n", window_width, window_height) > 0;
+    for (int y = 0; y < window_height && written; y++) {
+        const uint8_t* pixels = (const uint8_t*) &color_buffer[window_width * y];
         for (int x = 0; x < window_width; x++) {
-            if (x % 20 == 0 || y % 20 == 0) {
-                color_buffer[(window_width * y) + x] = 0xFFFFFFFF;
-            }
+            row[x * 3 + 0] = pixels[x * 4 + 0];
+            row[x * 3 + 1] = pixels[x * 4 + 1];
+            row[x * 3 + 2] = pixels[x * 4 + 2];
         }
+        written = fwrite(row, 3, window_width, file) == (size_t)window_width;
     }
+    free(row);
+    if (fclose(file) != 0) {
+        written = false;
+    }
+    if (!written) {
+        fprintf(stderr, "Error writing %s.\n", filename);
+    }
+    return written;
+}
+
+// White lines every 20 pixels, whole rows at once for the horizontal ones
+static void draw_grid_into(uint32_t* pixels) {
+    for (int y = 0; y < window_height; y++) {
+        uint32_t* row = &pixels[window_width * y];
+        if (y % 20 == 0) {
+            fill_pixels(row, window_width, 0xFFFFFFFF);
+            continue;
+        }
+        for (int x = 0; x < window_width; x += 20) {
+            row[x] = 0xFFFFFFFF;
+        }
+    }
+}
+
+void draw_grid(void) {
+    draw_grid_into(color_buffer);
 }
 
 void draw_pixel(int x, int y, uint32_t color){
     if (x >= 0 && x < window_width && y >= 0 && y < window_height) {
         color_buffer[(window_width * y) + x] = color;
+        frame_stats.pixels++;
     }
     
 }
 
 void draw_line(int x0, int y0, int x1, int y1, uint32_t color) {
-    int delta_x = (x1 - x0);
-    int delta_y = (y1 - y0);
-    
-    int longest_site_length = (abs(delta_x) >= abs(delta_y)) ? abs(delta_x) : abs(delta_y);
-    
-    
-    float x_inc = delta_x / (float)longest_site_length;
-    float y_inc = delta_y / (float)longest_site_length;
-    
-    float current_x = x0;
-    float current_y = y0;
-    
-    for (int i = 0; i <= longest_site_length; i++) {
-        draw_pixel(round(current_x), round(current_y), color);
-        current_x += x_inc;
-        current_y += y_inc;
-               
-            
-        }
+    clip_rect_t clip = screen_clip_rect();
+    draw_line_clipped(x0, y0, x1, y1, color, &clip);
+    frame_stats.pixels += clip.pixels;
 }
 
+// Cohen-Sutherland outcode of a point, which sides of the clip rectangle it lies beyond
+enum {
+    OUTCODE_LEFT = 1 << 0,
+    OUTCODE_RIGHT = 1 << 1,
+    OUTCODE_TOP = 1 << 2,
+    OUTCODE_BOTTOM = 1 << 3
+};
 
+static int clip_outcode(int x, int y, const clip_rect_t* clip) {
+    return
+        (x < clip->x_min ? OUTCODE_LEFT : 0) |
+        (x >= clip->x_max ? OUTCODE_RIGHT : 0) |
+        (y < clip->y_min ? OUTCODE_TOP : 0) |
+        (y >= clip->y_max ? OUTCODE_BOTTOM : 0);
+}
 
-void draw_rect(int x, int y, int width, int height, uint32_t color) {
-	for (int j = 0; j < width; j++) {
-            for (int k = 0; k < height; k++) {
-		int current_x = x + j;
-		int current_y = y + k;
-                draw_pixel(current_x, current_y, color);
+///////////////////////////////////////////////////////////////////////////////
+// Integer Bresenham line, clipped to the rectangle before the first step.
+///////////////////////////////////////////////////////////////////////////////
+// The line steps one pixel at a time along its major axis, and step i moves the minor axis by
+// floor((2 * i * minor_delta + major_delta) / (2 * major_delta)) pixels. The outcodes reject the
+// lines that stay beyond one side of the rectangle. The others are clipped by solving that formula
+// for the first and last steps inside, rather than by moving the endpoints, so every tile writes
+// exactly the pixels of the unclipped line.
+///////////////////////////////////////////////////////////////////////////////
+void draw_line_clipped(int x0, int y0, int x1, int y1, uint32_t color, clip_rect_t* clip) {
+    int outcode0 = clip_outcode(x0, y0, clip);
+    int outcode1 = clip_outcode(x1, y1, clip);
+    if (outcode0 & outcode1) {
+        return;
+    }
+
+    int delta_x = abs(x1 - x0);
+    int delta_y = abs(y1 - y0);
+    int step_x = (x1 >= x0) ? 1 : -1;
+    int step_y = (y1 >= y0) ? 1 : -1;
+    bool steep = delta_y > delta_x;
+    int64_t major_delta = steep ? delta_y : delta_x;
+    int64_t minor_delta = steep ? delta_x : delta_y;
+    if (major_delta == 0) {
+        // Both ends on the same pixel, which is inside since the outcodes are equal
+        color_buffer[(window_width * y0) + x0] = color;
+        clip->pixels++;
+        return;
+    }
+    int major_start = steep ? y0 : x0;
+    int minor_start = steep ? x0 : y0;
+    int major_step = steep ? step_y : step_x;
+    int minor_step = steep ? step_x : step_y;
+
+    // Steps from first to last (included) are inside the rectangle
+    int64_t first = 0;
+    int64_t last = major_delta;
+    if (outcode0 | outcode1) {
+        int major_min = steep ? clip->y_min : clip->x_min;
+        int major_max = (steep ? clip->y_max : clip->x_max) - 1;
+        int minor_min = steep ? clip->x_min : clip->y_min;
+        int minor_max = (steep ? clip->x_max : clip->y_max) - 1;
+
+        // Along the major axis the step is the distance in pixels
+        int64_t major_first = (major_step > 0) ? major_min - major_start : major_start - major_max;
+        int64_t major_last = (major_step > 0) ? major_max - major_start : major_start - major_min;
+        if (major_first > first) first = major_first;
+        if (major_last < last) last = major_last;
+
+        // Minor axis pixels moved by the steps entering and leaving the rectangle
+        int64_t moved_first = (minor_step > 0) ? minor_min - minor_start : minor_start - minor_max;
+        int64_t moved_last = (minor_step > 0) ? minor_max - minor_start : minor_start - minor_min;
+        if (moved_last < 0) {
+            return;
+        }
+        if (moved_first > 0) {
+            if (minor_delta == 0) {
+                return;
             }
+            // Smallest i with 2 * i * minor_delta + major_delta >= 2 * major_delta * moved_first
+            int64_t numerator = 2 * major_delta * moved_first - major_delta;
+            int64_t minor_first = (numerator + 2 * minor_delta - 1) / (2 * minor_delta);
+            if (minor_first > first) first = minor_first;
+        }
+        if (minor_delta > 0) {
+            // Largest i with 2 * i * minor_delta + major_delta < 2 * major_delta * (moved_last + 1)
+            int64_t minor_last = (2 * major_delta * (moved_last + 1) - major_delta - 1) / (2 * minor_delta);
+            if (minor_last < last) last = minor_last;
+        }
+        if (first > last) {
+            return;
+        }
+    }
+
+    // Bresenham state at the first step: the minor offset and the remainder of the formula above
+    int64_t numerator = 2 * first * minor_delta + major_delta;
+    int64_t error = numerator % (2 * major_delta);
+    int major = major_start + major_step * (int)first;
+    int minor = minor_start + minor_step * (int)(numerator / (2 * major_delta));
+    int x = steep ? minor : major;
+    int y = steep ? major : minor;
+    int index = (window_width * y) + x;
+    int major_stride = steep ? step_y * window_width : step_x;
+    int minor_stride = steep ? step_x : step_y * window_width;
+
+    for (int64_t i = first; i <= last; i++) {
+        color_buffer[index] = color;
+        index += major_stride;
+        error += 2 * minor_delta;
+        if (error >= 2 * major_delta) {
+            error -= 2 * major_delta;
+            index += minor_stride;
         }
+    }
+    clip->pixels += last - first + 1;
+}
+
+// Store count copies of color from pixels on. Aligned 16 byte stores once the pointer allows,
+// this is what every horizontal run of a flat color ends up in.
+void fill_pixels(uint32_t* pixels, int count, uint32_t color) {
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i < count && ((uintptr_t)(pixels + i) & 15) != 0; i++) {
+        pixels[i] = color;
+    }
+    __m128i colors = _mm_set1_epi32((int)color);
+    for (; i + 16 <= count; i += 16) {
+        _mm_store_si128((__m128i*)(pixels + i), colors);
+        _mm_store_si128((__m128i*)(pixels + i + 4), colors);
+        _mm_store_si128((__m128i*)(pixels + i + 8), colors);
+        _mm_store_si128((__m128i*)(pixels + i + 12), colors);
+    }
+    for (; i + 4 <= count; i += 4) {
+        _mm_store_si128((__m128i*)(pixels + i), colors);
+    }
+#endif
+    for (; i < count; i++) {
+        pixels[i] = color;
+    }
+}
+
+// fill_pixels with non-temporal stores for the clears, which go straight to memory instead of
+// pushing the rest of the frame out of the cache. clear_color_buffer fences them.
+static void stream_pixels(uint32_t* pixels, int count, uint32_t color) {
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i < count && ((uintptr_t)(pixels + i) & 15) != 0; i++) {
+        pixels[i] = color;
+    }
+    __m128i colors = _mm_set1_epi32((int)color);
+    for (; i + 16 <= count; i += 16) {
+        _mm_stream_si128((__m128i*)(pixels + i), colors);
+        _mm_stream_si128((__m128i*)(pixels + i + 4), colors);
+        _mm_stream_si128((__m128i*)(pixels + i + 8), colors);
+        _mm_stream_si128((__m128i*)(pixels + i + 12), colors);
+    }
+    for (; i + 4 <= count; i += 4) {
+        _mm_stream_si128((__m128i*)(pixels + i), colors);
+    }
+#endif
+    for (; i < count; i++) {
+        pixels[i] = color;
+    }
+}
+
+static void stream_depths(float* depths, int count, float depth) {
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i < count && ((uintptr_t)(depths + i) & 15) != 0; i++) {
+        depths[i] = depth;
+    }
+    __m128 values = _mm_set1_ps(depth);
+    for (; i + 16 <= count; i += 16) {
+        _mm_stream_ps(depths + i, values);
+        _mm_stream_ps(depths + i + 4, values);
+        _mm_stream_ps(depths + i + 8, values);
+        _mm_stream_ps(depths + i + 12, values);
+    }
+    for (; i + 4 <= count; i += 4) {
+        _mm_stream_ps(depths + i, values);
+    }
+#endif
+    for (; i < count; i++) {
+        depths[i] = depth;
+    }
 }
 
-void render_color_buffer(void) {
+// Horizontal run of pixels [x_start, x_end) on row y, limited to the clip rectangle
+void draw_span_clipped(int y, int x_start, int x_end, uint32_t color, clip_rect_t* clip) {
+    if (y < clip->y_min || y >= clip->y_max) {
+        return;
+    }
+    if (x_start < clip->x_min) {
+        x_start = clip->x_min;
+    }
+    if (x_end > clip->x_max) {
+        x_end = clip->x_max;
+    }
+    if (x_start >= x_end) {
+        return;
+    }
+    fill_pixels(&color_buffer[(window_width * y) + x_start], x_end - x_start, color);
+    clip->pixels += x_end - x_start;
+}
+
+void draw_rect(int x, int y, int width, int height, uint32_t color) {
+    clip_rect_t clip = screen_clip_rect();
+    draw_rect_clipped(x, y, width, height, color, &clip);
+    frame_stats.pixels += clip.pixels;
+}
+
+void draw_rect_clipped(int x, int y, int width, int height, uint32_t color, clip_rect_t* clip) {
+    for (int current_y = y; current_y < y + height; current_y++) {
+        draw_span_clipped(current_y, x, x + width, color, clip);
+    }
+}
+
+// The whole color buffer
+clip_rect_t screen_clip_rect(void) {
+    clip_rect_t clip = { 0, 0, window_width, window_height, 0 };
+    return clip;
+}
+
+// Present the color buffer, returns false when a headless frame could not be written
+bool render_color_buffer(void) {
+    if (display_backend == DISPLAY_HEADLESS) {
+        bool written = true;
+        if (headless_output_prefix != NULL) {
+            char filename[1024];
+            snprintf(filename, sizeof(filename), "%s%04d.ppm", headless_output_prefix, headless_frame_count);
+            written = write_color_buffer_ppm(filename);
+        }
+        headless_frame_count++;
+        return written;
+    }
 	SDL_UpdateTexture(
 		color_buffer_texture,
 		NULL,
@@ -106,20 +438,113 @@ void render_color_buffer(void) {
 		(int)(window_width * sizeof(uint32_t))
 	);
 	SDL_RenderCopy(renderer, color_buffer_texture, NULL, NULL);
+    return true;
+}
+
+// Start a new frame with nothing drawn
+void reset_dirty_rect(void) {
+    dirty_x_min = window_width;
+    dirty_y_min = window_height;
+    dirty_x_max = -1;
+    dirty_y_max = -1;
 }
 
+// Grow the dirty rectangle to hold the inclusive pixel bounds, which may reach off the screen
+void mark_dirty_rect(int x_min, int y_min, int x_max, int y_max) {
+    if (x_min < dirty_x_min) dirty_x_min = x_min;
+    if (y_min < dirty_y_min) dirty_y_min = y_min;
+    if (x_max > dirty_x_max) dirty_x_max = x_max;
+    if (y_max > dirty_y_max) dirty_y_max = y_max;
+}
+
+// Rows and columns a clear has to reset, [x_min, x_max) x [y_min, y_max), empty when nothing was drawn
+static clip_rect_t clear_rect(void) {
+    clip_rect_t rect = screen_clip_rect();
+    if (clear_method == CLEAR_DIRTY) {
+        if (dirty_x_min > rect.x_min) rect.x_min = dirty_x_min;
+        if (dirty_y_min > rect.y_min) rect.y_min = dirty_y_min;
+        if (dirty_x_max + 1 < rect.x_max) rect.x_max = dirty_x_max + 1;
+        if (dirty_y_max + 1 < rect.y_max) rect.y_max = dirty_y_max + 1;
+    }
+    return rect;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Clear the color buffer back to the background, either streaming the clear color or copying
+// the rows of the prebuilt grid layer. The whole buffer is cleared when the background changed
+// since the last clear, since the pixels outside the dirty rectangle still show the old one.
+///////////////////////////////////////////////////////////////////////////////
 void clear_color_buffer(uint32_t color) {
-	for (int y = 0; y < window_height; y++) {
-		for (int x = 0; x < window_width; x++) {
-			color_buffer[(window_width * y) + x] = color;
-		}
-	}
-	
+    if (background_method == BACKGROUND_GRID && (background_layer == NULL || background_layer_color != color)) {
+        if (background_layer == NULL) {
+            background_layer = (uint32_t*) malloc(sizeof(uint32_t) * window_width * window_height);
+        }
+        if (background_layer == NULL) {
+            background_method = BACKGROUND_SOLID;
+        } else {
+            fill_pixels(background_layer, window_width * window_height, color);
+            draw_grid_into(background_layer);
+            background_layer_color = color;
+        }
+    }
+    bool full = !color_buffer_cleared || cleared_background != background_method || cleared_color != color;
+    color_buffer_cleared = true;
+    cleared_background = background_method;
+    cleared_color = color;
+
+    clip_rect_t rect = full ? screen_clip_rect() : clear_rect();
+    if (rect.x_min >= rect.x_max || rect.y_min >= rect.y_max) {
+        return;
+    }
+    bool whole_rows = (rect.x_min == 0 && rect.x_max == window_width);
+    if (background_method == BACKGROUND_GRID) {
+        if (whole_rows) {
+            int offset = window_width * rect.y_min;
+            memcpy(color_buffer + offset, background_layer + offset, sizeof(uint32_t) * window_width * (rect.y_max - rect.y_min));
+        } else {
+            for (int y = rect.y_min; y < rect.y_max; y++) {
+                int offset = (window_width * y) + rect.x_min;
+                memcpy(color_buffer + offset, background_layer + offset, sizeof(uint32_t) * (rect.x_max - rect.x_min));
+            }
+        }
+    } else if (whole_rows) {
+        stream_pixels(color_buffer + window_width * rect.y_min, window_width * (rect.y_max - rect.y_min), color);
+    } else {
+        for (int y = rect.y_min; y < rect.y_max; y++) {
+            stream_pixels(color_buffer + (window_width * y) + rect.x_min, rect.x_max - rect.x_min, color);
+        }
+    }
+#if defined(__SSE2__)
+    _mm_sfence();
+#endif
+}
+
+// Reset the depths, of the dirty rectangle only in CLEAR_DIRTY since nothing else was drawn
+void clear_z_buffer(void) {
+    clip_rect_t rect = clear_rect();
+    if (rect.x_min >= rect.x_max || rect.y_min >= rect.y_max) {
+        return;
+    }
+    if (rect.x_min == 0 && rect.x_max == window_width) {
+        stream_depths(z_buffer + window_width * rect.y_min, window_width * (rect.y_max - rect.y_min), 1.0);
+    } else {
+        for (int y = rect.y_min; y < rect.y_max; y++) {
+            stream_depths(z_buffer + (window_width * y) + rect.x_min, rect.x_max - rect.x_min, 1.0);
+        }
+    }
+#if defined(__SSE2__)
+    _mm_sfence();
+#endif
 }
 
 void destroy_window(void) {
-	SDL_DestroyRenderer(renderer);
-	SDL_DestroyWindow(window);
+    if (display_backend == DISPLAY_WINDOW) {
+        SDL_DestroyTexture(color_buffer_texture);
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+    }
+    free(background_layer);
+    background_layer = NULL;
 	SDL_Quit();
 
 }
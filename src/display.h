@@ -8,10 +8,17 @@
 #define FPS 60
 #define FRAME_TARGET_TIME (1000 / FPS)
 
+// Counters filled while a frame is processed, read back by the benchmark
+typedef struct {
+    int triangles;    // triangles handed to the rasterizer
+    uint64_t pixels;  // pixels written into the color buffer
+} frame_stats_t;
+
 enum cull_method {
     CULL_NONE,
-    CULL_BACKFACE
-} cull_method;
+    CULL_BACKFACE,
+    CULL_SCREEN_AREA
+};
 
 enum render_method {
     RENDER_WIRE,
@@ -20,27 +27,111 @@ enum render_method {
     RENDER_FILL_TRIANGLE_WIRE,
     RENDER_TEXTURED,
     RENDER_TEXTURED_WIRE
-} render_method;
+};
+
+// How hidden surfaces are removed: sorting whole triangles by their average depth,
+// or testing every pixel against the z-buffer (optionally drawing the closest first)
+enum depth_method {
+    DEPTH_PAINTER,
+    DEPTH_ZBUFFER,
+    DEPTH_ZBUFFER_FRONT_TO_BACK
+};
+
+// How textured spans find their texture coordinates: a perspective divide at every pixel, or
+// only every SUBDIVIDE_SPAN pixels with affine steps in between (falling back to the divide per
+// pixel on triangles with a large depth range)
+enum texture_method {
+    TEXTURE_PERSPECTIVE,
+    TEXTURE_SUBDIVIDED
+};
+
+// How textured pixels sample the texture: the closest texel, or a blend of the 4 around them
+enum texture_filter {
+    FILTER_NEAREST,
+    FILTER_BILINEAR
+};
+
+// Lighting of the textured modes: none (the filled modes stay flat shaded), or the light
+// intensity of every vertex interpolated across the triangle and multiplied into the texels
+enum shading_method {
+    SHADING_FLAT,
+    SHADING_GOURAUD
+};
+
+// What clear_color_buffer puts back: the clear color, or a prebuilt layer with the grid of
+// draw_grid over it
+enum background_method {
+    BACKGROUND_SOLID,
+    BACKGROUND_GRID
+};
+
+// Which pixels the clears reset: the whole screen, or only the bounds of what the last frame drew
+enum clear_method {
+    CLEAR_FULL,
+    CLEAR_DIRTY
+};
+
+// Screen rectangle a draw call is limited to, [x_min, x_max) x [y_min, y_max). Every render
+// thread draws through its own, which also counts the pixels it wrote instead of frame_stats.
+typedef struct {
+    int x_min;
+    int y_min;
+    int x_max;
+    int y_max;
+    uint64_t pixels;
+} clip_rect_t;
+
+// Where the color buffer ends up every frame: an SDL window, or memory only
+enum display_backend {
+    DISPLAY_WINDOW,
+    DISPLAY_HEADLESS
+};
+
+extern enum cull_method cull_method;
+extern enum render_method render_method;
+extern enum depth_method depth_method;
+extern enum texture_method texture_method;
+extern enum texture_filter texture_filter;
+extern enum shading_method shading_method;
+extern enum background_method background_method;
+extern enum clear_method clear_method;
+extern enum display_backend display_backend;
+
+extern bool frame_rate_capped;
+extern int render_threads;
+extern frame_stats_t frame_stats;
 
 extern SDL_Window* window;
 extern SDL_Renderer* renderer;
 extern uint32_t* color_buffer;
+extern float* z_buffer;
 extern SDL_Texture* color_buffer_texture;
 extern int window_width;
 extern int window_height;
 
 bool initialize_window(void);
+bool initialize_headless(int width, int height, const char* output_prefix);
+bool create_color_buffer(void);
+bool write_color_buffer_ppm(const char* filename);
 void draw_grid(void);
 void draw_pixel(int x, int y, uint32_t color);
 void draw_line(int x0, int y0, int x1, int y1, uint32_t color);
+void draw_line_clipped(int x0, int y0, int x1, int y1, uint32_t color, clip_rect_t* clip);
 //void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color);
+void fill_pixels(uint32_t* pixels, int count, uint32_t color);
+void draw_span_clipped(int y, int x_start, int x_end, uint32_t color, clip_rect_t* clip);
 void draw_rect(int x, int y, int width, int height, uint32_t color);
+void draw_rect_clipped(int x, int y, int width, int height, uint32_t color, clip_rect_t* clip);
+clip_rect_t screen_clip_rect(void);
 /*
 void draw_flat_bottonm(x0, y0, x1, y1, Mx, My);
 void draw_flat_top(x1, y1, Mx, My, X2, y2):
 */
-void render_color_buffer(void);
+bool render_color_buffer(void);
+void reset_dirty_rect(void);
+void mark_dirty_rect(int x_min, int y_min, int x_max, int y_max);
 void clear_color_buffer(uint32_t color);
+void clear_z_buffer(void);
 void destroy_window(void);
 
 
@@ -1,6 +1,10 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <math.h>
 #include <SDL2/SDL.h>
 #include "upng.h"
 #include "array.h"
@@ -12,23 +16,99 @@
 #include "triangle.h"
 #include "texture.h"
 #include "mesh.h"
+#include "clipping.h"
+#include "span.h"
+#include "tiles.h"
+#include "bench.h"
+#include "profile.h"
 
 // Array of triangles that should be rendered frame by frame
 triangle_t* triangles_to_render = NULL;
 
+// Indices into triangles_to_render in drawing order (farthest first)
+uint32_t* triangle_order = NULL;
+
+// Every mesh vertex transformed to world space and projected to the screen, once per frame
+vec4_t* transformed_vertex_buffer = NULL;
+vec4_t* projected_vertex_buffer = NULL;
+vec4_t* clip_vertex_buffer = NULL; // projected vertices before the perspective divide
+uint16_t* outcode_buffer = NULL; // clipping planes each vertex is outside of
+int vertex_buffer_capacity = 0;
+
+// Light intensity of every vertex normal of the mesh for the Gouraud shading, once per frame
+float* vertex_intensity_buffer = NULL;
+int intensity_buffer_capacity = 0;
+
+// Wireframe lines and vertex markers of the faces that survived culling. Every edge and vertex
+// shared by several faces is listed once per frame, with the last triangle drawn that uses it, and
+// is drawn right after the fill of that triangle so the nearer triangles still cover it. The
+// stamps hold the last frame each one was listed in.
+typedef struct {
+    int x0, y0, x1, y1;
+} overlay_line_t;
+
+typedef struct {
+    int x, y; // top left corner of the marker
+} overlay_marker_t;
+
+// Lines and markers drawn after one triangle of triangles_to_render
+typedef struct {
+    int first_line, num_lines;
+    int first_marker, num_markers;
+    int x_min, y_min, x_max, y_max; // inclusive pixel bounds of all of them
+} triangle_overlay_t;
+
+overlay_line_t* overlay_lines = NULL;
+overlay_marker_t* overlay_markers = NULL;
+int num_overlay_lines = 0;
+int num_overlay_markers = 0;
+uint32_t* edge_stamps = NULL;
+uint32_t* vertex_stamps = NULL;
+uint32_t overlay_stamp = 0;
+int overlay_edge_capacity = 0;
+int overlay_vertex_capacity = 0;
+triangle_overlay_t* triangle_overlays = NULL;
+
 vec3_t camera_position = { 0, 0, 0 }; // 9x9x9 cube
 //vec3_t cube_rotation = {.x = 0, .y = 0, .z = 0};
 
 
 // Global variables for execution status and game loop
 bool is_running = false;
+bool output_failed = false; // a headless frame could not be written
 int previous_frame_time = 0;
+
+// Command line options for running without a display
+bool headless = false;
+int headless_width = 800;
+int headless_height = 600;
+int headless_frames = -1;
+char* headless_output = NULL;
+
+// Command line options for the benchmark, which always runs headless
+bool benchmark = false;
+bool vertex_benchmark = false;
+bench_options_t bench_options = {
+    .frames = 100,
+    .csv_filename = NULL,
+    .json_filename = NULL,
+    .baseline_filename = NULL,
+    .tolerance = 0.1,
+    .allow_missing = false
+};
+
+// Chrome trace_event JSON written at exit by profiling builds
+char* trace_filename = NULL;
 ////float fov_factor = 640;
 
 mat4_t proj_matrix;
 
+// View frustum planes taken from proj_matrix, the camera sits at the origin looking down +z
+plane_t frustum_planes[NUM_FRUSTUM_PLANES];
+
 // Setup function to initialize variables and game objects
-void setup(void) {
+// Returns false, with is_running cleared, when anything the first frame needs failed to load
+bool setup(void) {
     
     // Initialize render mode and triangle culling method
     render_method = RENDER_TEXTURED;
@@ -36,17 +116,18 @@ void setup(void) {
     
     
     
-	// Alloc the memory in bytes to hold the color buffer
-	color_buffer = (uint32_t*) malloc(sizeof(uint32_t) * window_width * window_height);
-	// Creating a SDL texture that is used to display the color
-	color_buffer_texture = SDL_CreateTexture(
-		renderer,
-		//SDL_PIXELFORMAT_ARGB8888,
-        SDL_PIXELFORMAT_RGBA32,
-		SDL_TEXTUREACCESS_STREAMING,
-		window_width,
-		window_height
-	);
+	// Alloc the color buffer, and the SDL texture used to display it when there is a window
+	if (!create_color_buffer()) {
+        is_running = false;
+        return false;
+    }
+
+    // Start the threads rasterizing the screen tiles
+    if (!tiles_init(render_threads)) {
+        is_running = false;
+        return false;
+    }
+    init_span_kernels();
     
     // TODO: Initialize the perspective projection matrix
     float fov = M_PI / 3.0; // pí divided by 3
@@ -54,6 +135,7 @@ void setup(void) {
     float znear = 0.1;
     float zfar = 100.0;
     proj_matrix = mat4_make_perspective(fov, aspect, znear, zfar);
+    init_frustum_planes(&proj_matrix, frustum_planes);
     
     
     // Manually load the hardcoded data from the static code array
@@ -65,11 +147,17 @@ void setup(void) {
     // Loads the cube values in the mesh data structure
     ///load_cube_mesh_data();
     
-    load_obj_file_data("./assets/crab.obj");
-    load_png_texture_data("./assets/crab.png");
-    
-    
-
+    if (!load_obj_file_data("./assets/crab.obj")) {
+        is_running = false;
+        return false;
+    }
+    // The textured render methods sample level 0 of the texture without checking for it
+    if (!load_png_texture_data("./assets/crab.png")) {
+        fprintf(stderr, "Error loading ./assets/crab.png.\n");
+        is_running = false;
+        return false;
+    }
+    return true;
 }
 
 
@@ -100,19 +188,103 @@ void process_input(void) {
                 cull_method = CULL_BACKFACE;
             if (event.key.keysym.sym == SDLK_d)
                 cull_method = CULL_NONE;
+            if (event.key.keysym.sym == SDLK_a)
+                cull_method = CULL_SCREEN_AREA;
+            if (event.key.keysym.sym == SDLK_p)
+                depth_method = DEPTH_PAINTER;
+            if (event.key.keysym.sym == SDLK_z)
+                depth_method = DEPTH_ZBUFFER;
+            if (event.key.keysym.sym == SDLK_x)
+                depth_method = DEPTH_ZBUFFER_FRONT_TO_BACK;
+            if (event.key.keysym.sym == SDLK_t)
+                texture_method = TEXTURE_PERSPECTIVE;
+            if (event.key.keysym.sym == SDLK_s)
+                texture_method = TEXTURE_SUBDIVIDED;
+            if (event.key.keysym.sym == SDLK_m)
+                mipmapping = true;
+            if (event.key.keysym.sym == SDLK_n)
+                mipmapping = false;
+            if (event.key.keysym.sym == SDLK_b)
+                texture_filter = FILTER_BILINEAR;
+            if (event.key.keysym.sym == SDLK_v)
+                texture_filter = FILTER_NEAREST;
+            if (event.key.keysym.sym == SDLK_g)
+                shading_method = SHADING_GOURAUD;
+            if (event.key.keysym.sym == SDLK_f)
+                shading_method = SHADING_FLAT;
             break;
 	}
 	
 }
 
 
+// Test the bounding sphere first, then the tighter box for the meshes the sphere can't reject
+bool is_mesh_outside_frustum(const mat4_t* world_matrix) {
+    const mat4_t* m = world_matrix;
+    vec4_t center = mat4_mul_vec4(*m, vec4_from_vec3(mesh.bounds.center));
+    float scale = fmaxf(
+        vec3_length((vec3_t){ m->m[0][0], m->m[1][0], m->m[2][0] }), fmaxf(
+        vec3_length((vec3_t){ m->m[0][1], m->m[1][1], m->m[2][1] }),
+        vec3_length((vec3_t){ m->m[0][2], m->m[1][2], m->m[2][2] }))
+    );
+    if (is_sphere_outside_frustum(frustum_planes, vec3_from_vec4(center), mesh.bounds.radius * scale)) {
+        return true;
+    }
+    return is_box_outside_frustum(frustum_planes, world_matrix, mesh.bounds.min, mesh.bounds.max);
+}
+
+// List the edges, and the vertices when markers is set, of a visible face that no triangle drawn
+// after it listed yet this frame
+void add_face_overlays(int face, bool markers) {
+    for (int k = 0; k < 3; k++) {
+        uint32_t edge = mesh.soa.face_edges[face * 3 + k];
+        if (edge_stamps[edge] != overlay_stamp) {
+            edge_stamps[edge] = overlay_stamp;
+            uint32_t a = mesh.soa.edges[edge * 2];
+            uint32_t b = mesh.soa.edges[edge * 2 + 1];
+            vec4_t start = projected_vertex_buffer[a];
+            vec4_t end = projected_vertex_buffer[b];
+            bool inside = true;
+            uint16_t clip_planes = (outcode_buffer[a] | outcode_buffer[b]) & CLIP_PLANES_MASK;
+            if (clip_planes != 0) {
+                // Cut the part behind the camera or past the guard band before the divide
+                start = clip_vertex_buffer[a];
+                end = clip_vertex_buffer[b];
+                inside = clip_segment(&start, &end, clip_planes);
+                start = clip_to_screen(start, window_width, window_height);
+                end = clip_to_screen(end, window_width, window_height);
+            }
+            if (inside) {
+                overlay_lines[num_overlay_lines++] = (overlay_line_t){ (int)start.x, (int)start.y, (int)end.x, (int)end.y };
+            }
+        }
+
+        uint32_t vertex = mesh.soa.indices[face * 3 + k];
+        if (markers && vertex_stamps[vertex] != overlay_stamp) {
+            vertex_stamps[vertex] = overlay_stamp;
+            if (!(outcode_buffer[vertex] & CLIP_PLANES_MASK)) {
+                vec4_t point = projected_vertex_buffer[vertex];
+                overlay_markers[num_overlay_markers++] = (overlay_marker_t){ (int)(point.x - 3), (int)(point.y - 3) };
+            }
+        }
+    }
+}
+
+// Grow the pixel bounds of the overlays of a triangle to hold an inclusive rectangle
+void grow_overlay_bounds(triangle_overlay_t* overlay, int x_min, int y_min, int x_max, int y_max) {
+    if (x_min < overlay->x_min) overlay->x_min = x_min;
+    if (y_min < overlay->y_min) overlay->y_min = y_min;
+    if (x_max > overlay->x_max) overlay->x_max = x_max;
+    if (y_max > overlay->y_max) overlay->y_max = y_max;
+}
+
 void update(void) {
     
     // Wait some time until the reach the target frame time in milliseconds
     int time_to_wait = FRAME_TARGET_TIME - (SDL_GetTicks() - previous_frame_time);
 
     // Only delay execution if we are running too fast
-    if (time_to_wait > 0 && time_to_wait <= FRAME_TARGET_TIME) {
+    if (frame_rate_capped && time_to_wait > 0 && time_to_wait <= FRAME_TARGET_TIME) {
         SDL_Delay(time_to_wait);
     }
     
@@ -123,123 +295,117 @@ void update(void) {
     triangles_to_render = NULL;
     
     // Change the mesh scale/rotation values per animation frame
-    //mesh.rotation.x += 0.003;
-    mesh.rotation.y += 0.03;
-    //mesh.rotation.z += 0.002;
-    
-    //mesh.scale.x += 0.000;
-    //mesh.scale.y += 0.000;
-    
-    mesh.translation.z = 5.0;
-    //mesh.translation.x += 0.0;
-    
-    // create a scale and translation matrix to multiply mesh vertices
-    mat4_t scale_matrix = mat4_make_scale(mesh.scale.x, mesh.scale.y, mesh.scale.z);
-    
-    mat4_t translation_matrix = mat4_make_translation(mesh.translation.x, mesh.translation.y, mesh.translation.z);
+    transform_rotate(&mesh.transform, (vec3_t){ 0, 0.03, 0 });
+    
+    transform_set_translation(&mesh.transform, (vec3_t){ mesh.transform.translation.x, mesh.transform.translation.y, 5.0 });
+    
+    // The world matrix is only composed again when the transform changed
+    PROFILE_BEGIN(PROFILE_WORLD_TRANSFORM);
+    mat4_t world_matrix = *transform_get_world_matrix(&mesh.transform);
+    PROFILE_END(PROFILE_WORLD_TRANSFORM);
+    
+    // Skip the vertex and face stages when the whole mesh is outside the view frustum
+    PROFILE_BEGIN(PROFILE_CLIPPING);
+    bool mesh_visible = !is_mesh_outside_frustum(&world_matrix);
+    PROFILE_END(PROFILE_CLIPPING);
+    
+    // Transform every unique vertex of the mesh once per frame, the faces index into these
+    int num_vertices = mesh_visible ? mesh.soa.num_vertices : 0;
+    if (num_vertices > vertex_buffer_capacity) {
+        vertex_buffer_capacity = num_vertices;
+        transformed_vertex_buffer = (vec4_t*) realloc(transformed_vertex_buffer, sizeof(vec4_t) * vertex_buffer_capacity);
+        projected_vertex_buffer = (vec4_t*) realloc(projected_vertex_buffer, sizeof(vec4_t) * vertex_buffer_capacity);
+        clip_vertex_buffer = (vec4_t*) realloc(clip_vertex_buffer, sizeof(vec4_t) * vertex_buffer_capacity);
+        outcode_buffer = (uint16_t*) realloc(outcode_buffer, sizeof(uint16_t) * vertex_buffer_capacity);
+    }
     
-    mat4_t rotation_matrix_x = mat4_make_rotation_x(mesh.rotation.x);
-    mat4_t rotation_matrix_y = mat4_make_rotation_y(mesh.rotation.y);
-    mat4_t rotation_matrix_z = mat4_make_rotation_z(mesh.rotation.z);
+    PROFILE_BEGIN(PROFILE_WORLD_TRANSFORM);
+    mat4_mul_soa_batch(&world_matrix, mesh.soa.x, mesh.soa.y, mesh.soa.z, transformed_vertex_buffer, num_vertices);
+    PROFILE_END(PROFILE_WORLD_TRANSFORM);
+    
+    // Project to the screen, with the perspective divide and the viewport mapping
+    PROFILE_BEGIN(PROFILE_PROJECTION);
+    mat4_project_to_screen_batch(&proj_matrix, transformed_vertex_buffer, projected_vertex_buffer, clip_vertex_buffer, num_vertices, window_width, window_height);
+    PROFILE_END(PROFILE_PROJECTION);
+    
+    PROFILE_BEGIN(PROFILE_CLIPPING);
+    compute_outcodes(clip_vertex_buffer, outcode_buffer, num_vertices);
+    PROFILE_END(PROFILE_CLIPPING);
+    
+    // Cull in object space: the camera is moved into the space of the mesh once per frame,
+    // so each face only needs one dot product with its precomputed plane
+    mat4_t object_matrix = mat4_inverse_affine(world_matrix);
+    vec4_t object_camera = mat4_mul_vec4(object_matrix, vec4_from_vec3(camera_position));
+    float orientation = (mat4_determinant_3x3(world_matrix) < 0) ? -1.0 : 1.0;
+    
+    // Light every unique vertex normal once, the faces only look up the intensities of their corners
+    bool gouraud = shading_method == SHADING_GOURAUD && (render_method == RENDER_TEXTURED || render_method == RENDER_TEXTURED_WIRE);
+    int num_normals = (mesh_visible && gouraud) ? mesh.soa.num_normals : 0;
+    if (num_normals > intensity_buffer_capacity) {
+        intensity_buffer_capacity = num_normals;
+        vertex_intensity_buffer = (float*) realloc(vertex_intensity_buffer, sizeof(float) * intensity_buffer_capacity);
+    }
+    for (int i = 0; i < num_normals; i++) {
+        // Normals go to world space through the transpose of the inverse, like the face normals below
+        vec3_t normal = {
+            object_matrix.m[0][0] * mesh.soa.vnx[i] + object_matrix.m[1][0] * mesh.soa.vny[i] + object_matrix.m[2][0] * mesh.soa.vnz[i],
+            object_matrix.m[0][1] * mesh.soa.vnx[i] + object_matrix.m[1][1] * mesh.soa.vny[i] + object_matrix.m[2][1] * mesh.soa.vnz[i],
+            object_matrix.m[0][2] * mesh.soa.vnx[i] + object_matrix.m[1][2] * mesh.soa.vny[i] + object_matrix.m[2][2] * mesh.soa.vnz[i]
+        };
+        vec3_normalize(&normal);
+        float intensity = -vec3_dot(normal, light.direction);
+        vertex_intensity_buffer[i] = (intensity > 0) ? ((intensity < 1) ? intensity : 1) : 0;
+    }
     
     // Loop all triangle faces of our mesh
-    int num_faces = array_length(mesh.faces);
+    int num_faces = mesh_visible ? mesh.soa.num_faces : 0;
     for (int i = 0; i < num_faces; i++) {
-        face_t mesh_face = mesh.faces[i];
-        
-        vec3_t face_vertices[3];
-        face_vertices[0] = mesh.vertices[mesh_face.a - 1];
-        face_vertices[1] = mesh.vertices[mesh_face.b - 1];
-        face_vertices[2] = mesh.vertices[mesh_face.c - 1];
-        
-        
-        // Loop all three vertices of this current face and perform transformation
+        const uint32_t* face_indices = &mesh.soa.indices[i * 3];
+        const uint32_t* face_uvs = &mesh.soa.uv_indices[i * 3];
+        
+        // Skip the faces that are completely behind the camera or off one side of the screen
+        uint16_t outcode_a = outcode_buffer[face_indices[0]];
+        uint16_t outcode_b = outcode_buffer[face_indices[1]];
+        uint16_t outcode_c = outcode_buffer[face_indices[2]];
+        if (outcode_a & outcode_b & outcode_c & CLIP_REJECT_MASK) {
+            continue;
+        }
         
         vec4_t transformed_vertices[3];
+        transformed_vertices[0] = transformed_vertex_buffer[face_indices[0]];
+        transformed_vertices[1] = transformed_vertex_buffer[face_indices[1]];
+        transformed_vertices[2] = transformed_vertex_buffer[face_indices[2]];
         
-        for (int j = 0; j < 3; j++) {
-            
-            
-            // Use a matrix to scale our original vertex
-            // TODO: multiply the scale_matrix by the vertex
-            vec4_t transformed_vertex = vec4_from_vec3(face_vertices[j]);
-            
-            // Create World Matrix combining scale, rotation and translation
-            // Order matters: 1. scale, 2. rotate, 3. translate [T]*[R]*[S]*v
-            mat4_t world_matrix = mat4_identity();
-            world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_y, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_x, world_matrix);
-            world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
-            
-            //multiply all matrices and load in one operation
-            
-            transformed_vertex = mat4_mul_vec4(world_matrix, transformed_vertex);
-            
-            // translate vertex from the camera
-            //transformed_vertex.z += 5;
-            
-            // Save transformed vertex in the array of transformed vertices
-            transformed_vertices[j] = transformed_vertex;
+        vec4_t projected_points[3];
+        projected_points[0] = projected_vertex_buffer[face_indices[0]];
+        projected_points[1] = projected_vertex_buffer[face_indices[1]];
+        projected_points[2] = projected_vertex_buffer[face_indices[2]];
+        
+        PROFILE_BEGIN(PROFILE_BACKFACE_CULL);
+        bool is_backface = false;
+        bool in_front = projected_points[0].w > 0 && projected_points[1].w > 0 && projected_points[2].w > 0;
+        if (cull_method == CULL_SCREEN_AREA && in_front) {
+            // Signed area of the projected triangle, the winding flips when it faces away (y points down)
+            float area = (projected_points[1].x - projected_points[0].x) * (projected_points[2].y - projected_points[0].y) -
+                         (projected_points[2].x - projected_points[0].x) * (projected_points[1].y - projected_points[0].y);
+            is_backface = area < 0;
+        } else if (cull_method != CULL_NONE) {
+            // Which side of the face plane the camera is on, same sign as dot(normal, camera - a) in world space
+            float side = mesh.soa.nx[i] * object_camera.x + mesh.soa.ny[i] * object_camera.y + mesh.soa.nz[i] * object_camera.z - mesh.soa.nd[i];
+            is_backface = side * orientation < 0;
         }
-        
-        // TODO: Check backface culling
-        // loop all faces
-        vec3_t vector_a = vec3_from_vec4(transformed_vertices[0]); /*   A   */
-        vec3_t vector_b = vec3_from_vec4(transformed_vertices[1]); /*  / \  */
-        vec3_t vector_c = vec3_from_vec4(transformed_vertices[2]); /* C---B */
-        
-        // Get the vector subtraction of B-A and C-A
-        vec3_t vector_ab = vec3_sub(vector_b, vector_a);
-        vec3_t vector_ac = vec3_sub(vector_c, vector_a);
-        vec3_normalize(&vector_ab);
-        vec3_normalize(&vector_ac);
-        
-        // Compute the face normal (using cross product to find perpendicular)
-        vec3_t normal = vec3_cross(vector_ab, vector_ac);
-        
-        // Normalize the face normal vector
-        vec3_normalize(&normal);
-        
-        
-        // Find the vector between a point in the triangle and the camera origin
-        vec3_t camera_ray = vec3_sub(camera_position, vector_a);
-        
-        // calculate how aligned is the camera ray with the face...
-        float dot_normal_camera = vec3_dot(normal, camera_ray);
-        
-        
-        // bypass the triangles that are looking away from the camera
-        if ( cull_method == CULL_BACKFACE ) {
-            if (dot_normal_camera < 0) {
-                continue;
-            }
-            
+        PROFILE_END(PROFILE_BACKFACE_CULL);
+        if (is_backface) {
+            continue;
         }
         
-        
-        vec4_t projected_points[3];
-        
-        // Loop all three vertices to perform projection
-        for (int j = 0; j < 3; j++) {
-            // project the current vertices
-            projected_points[j] = mat4_mul_vec4_project (proj_matrix, transformed_vertices[j]);
-            
-            // invert y values to account flipped screen coordinate
-            projected_points[j].y *= -1;
-            
-            // scale into the view
-            projected_points[j].x *= (window_width / 2.0);
-            projected_points[j].y *= (window_height / 2.0);
-            
-            // translate the projected point to the middle of the screen
-            projected_points[j].x += (window_width / 2.0);
-            projected_points[j].y += (window_height / 2.0);
-            
-            
-            //projected_triangle.points[j] = projected_point;
-        }
+        // World space normal of the face for the flat shading
+        vec3_t normal = {
+            object_matrix.m[0][0] * mesh.soa.nx[i] + object_matrix.m[1][0] * mesh.soa.ny[i] + object_matrix.m[2][0] * mesh.soa.nz[i],
+            object_matrix.m[0][1] * mesh.soa.nx[i] + object_matrix.m[1][1] * mesh.soa.ny[i] + object_matrix.m[2][1] * mesh.soa.nz[i],
+            object_matrix.m[0][2] * mesh.soa.nx[i] + object_matrix.m[1][2] * mesh.soa.ny[i] + object_matrix.m[2][2] * mesh.soa.nz[i]
+        };
+        vec3_normalize(&normal);
         
         // calculate average depth for each face
         //float avg_depth = (transformed_vertices[0].z > transformed_vertices[1].z) ? transformed_vertices[1].z : transformed_vertices[0].z;
@@ -251,7 +417,7 @@ void update(void) {
         float light_intensity_factor = -vec3_dot( normal, light.direction);
         
         // calculate the triangle color based on the light angle
-        uint32_t triangle_color = light_apply_intensity(mesh_face.color, light_intensity_factor);
+        uint32_t triangle_color = light_apply_intensity(mesh.soa.colors[i], light_intensity_factor);
         
         triangle_t projected_triangle = {
             .points = {
@@ -260,39 +426,121 @@ void update(void) {
                 { projected_points[2].x, projected_points[2].y, projected_points[2].z, projected_points[2].w }
             },
                 .texcoords = {
-                    { mesh_face.a_uv.u, mesh_face.a_uv.v },
-                    { mesh_face.b_uv.u, mesh_face.b_uv.v },
-                    { mesh_face.c_uv.u, mesh_face.c_uv.v }
+                    { mesh.soa.u[face_uvs[0]], mesh.soa.v[face_uvs[0]] },
+                    { mesh.soa.u[face_uvs[1]], mesh.soa.v[face_uvs[1]] },
+                    { mesh.soa.u[face_uvs[2]], mesh.soa.v[face_uvs[2]] }
                 },
             .color = triangle_color,
-            .avg_depth = avg_depth
+            .avg_depth = avg_depth,
+            .face = i
             // TODO:
         };
+        if (gouraud) {
+            const uint32_t* face_normals = &mesh.soa.normal_indices[i * 3];
+            projected_triangle.intensities[0] = vertex_intensity_buffer[face_normals[0]];
+            projected_triangle.intensities[1] = vertex_intensity_buffer[face_normals[1]];
+            projected_triangle.intensities[2] = vertex_intensity_buffer[face_normals[2]];
+        }
         
         // save the projected triangle in an array of triangles to render
         //triangles_to_render[i] = projected_triangle;
-        array_push(triangles_to_render, projected_triangle);
-        
-        
-        // sort by bubbles sort method....
-        
-        int n = array_length(triangles_to_render);
+        uint16_t clip_planes = (outcode_a | outcode_b | outcode_c) & CLIP_PLANES_MASK;
+        if (clip_planes == 0) {
+            array_push(triangles_to_render, projected_triangle);
+            continue;
+        }
         
-            for (int i = 0; i < n; i++) {
-                for (int j = i; j < n ; j++) {
-                    if (triangles_to_render[i].avg_depth < triangles_to_render[j].avg_depth) {
-                        // Swap arr[j] and arr[j + 1]
-                        triangle_t temp = triangles_to_render[i];
-                        triangles_to_render[i] = triangles_to_render[j];
-                        triangles_to_render[j] = temp;
-                    }
-                }
-            }
+        // The face crosses the near plane or the guard band, clip it before the divide and
+        // push the triangles of the resulting polygon instead
+        PROFILE_BEGIN(PROFILE_CLIPPING);
+        polygon_t polygon = polygon_from_triangle(
+            clip_vertex_buffer[face_indices[0]],
+            clip_vertex_buffer[face_indices[1]],
+            clip_vertex_buffer[face_indices[2]],
+            projected_triangle.texcoords[0],
+            projected_triangle.texcoords[1],
+            projected_triangle.texcoords[2],
+            projected_triangle.intensities
+        );
+        clip_polygon(&polygon, clip_planes);
+        triangle_t clipped_triangles[MAX_NUM_POLY_VERTICES - 2];
+        int num_clipped_triangles = triangles_from_polygon(&polygon, clipped_triangles, window_width, window_height);
+        for (int t = 0; t < num_clipped_triangles; t++) {
+            clipped_triangles[t].color = triangle_color;
+            clipped_triangles[t].avg_depth = avg_depth;
+            clipped_triangles[t].face = i;
+            array_push(triangles_to_render, clipped_triangles[t]);
+        }
+        PROFILE_END(PROFILE_CLIPPING);
         
         
     }
     
-    // TODO: sort the triangles to render according average depth
+    // Sort the triangles to render by average depth once all faces are processed,
+    // render() draws them following the sorted indices from back to front
+    PROFILE_BEGIN(PROFILE_DEPTH_SORT);
+    int num_triangles = array_length(triangles_to_render);
+    triangle_order = (uint32_t*) realloc(triangle_order, sizeof(uint32_t) * (num_triangles > 0 ? num_triangles : 1));
+    if (depth_method == DEPTH_ZBUFFER) {
+        // The z-buffer resolves visibility, submission order is fine
+        for (int i = 0; i < num_triangles; i++) {
+            triangle_order[i] = i;
+        }
+    } else {
+        sort_triangles_back_to_front(triangles_to_render, num_triangles, triangle_order);
+    }
+    PROFILE_END(PROFILE_DEPTH_SORT);
+    
+    // Hand every edge and vertex to the last triangle drawn with them, walking the drawing order
+    // of render() backwards
+    bool draw_edges = render_method == RENDER_WIRE || render_method == RENDER_WIRE_VERTEX || render_method == RENDER_FILL_TRIANGLE_WIRE || render_method == RENDER_TEXTURED_WIRE;
+    bool draw_markers = render_method == RENDER_WIRE_VERTEX;
+    if (mesh.soa.num_edges > overlay_edge_capacity) {
+        overlay_edge_capacity = mesh.soa.num_edges;
+        overlay_lines = (overlay_line_t*) realloc(overlay_lines, sizeof(overlay_line_t) * overlay_edge_capacity);
+        edge_stamps = (uint32_t*) realloc(edge_stamps, sizeof(uint32_t) * overlay_edge_capacity);
+        memset(edge_stamps, 0, sizeof(uint32_t) * overlay_edge_capacity);
+    }
+    if (mesh.soa.num_vertices > overlay_vertex_capacity) {
+        overlay_vertex_capacity = mesh.soa.num_vertices;
+        overlay_markers = (overlay_marker_t*) realloc(overlay_markers, sizeof(overlay_marker_t) * overlay_vertex_capacity);
+        vertex_stamps = (uint32_t*) realloc(vertex_stamps, sizeof(uint32_t) * overlay_vertex_capacity);
+        memset(vertex_stamps, 0, sizeof(uint32_t) * overlay_vertex_capacity);
+    }
+    triangle_overlays = (triangle_overlay_t*) realloc(triangle_overlays, sizeof(triangle_overlay_t) * (num_triangles > 0 ? num_triangles : 1));
+    num_overlay_lines = 0;
+    num_overlay_markers = 0;
+    overlay_stamp++;
+    for (int i = num_triangles - 1; i >= 0; i--) {
+        int order_index = (depth_method == DEPTH_ZBUFFER_FRONT_TO_BACK) ? num_triangles - 1 - i : i;
+        uint32_t index = triangle_order[order_index];
+        triangle_overlay_t* overlay = &triangle_overlays[index];
+        overlay->first_line = num_overlay_lines;
+        overlay->first_marker = num_overlay_markers;
+        if (draw_edges) {
+            add_face_overlays(triangles_to_render[index].face, draw_markers);
+        }
+        overlay->num_lines = num_overlay_lines - overlay->first_line;
+        overlay->num_markers = num_overlay_markers - overlay->first_marker;
+        
+        overlay->x_min = INT_MAX;
+        overlay->y_min = INT_MAX;
+        overlay->x_max = INT_MIN;
+        overlay->y_max = INT_MIN;
+        for (int k = 0; k < overlay->num_lines; k++) {
+            const overlay_line_t* line = &overlay_lines[overlay->first_line + k];
+            grow_overlay_bounds(overlay,
+                (line->x0 < line->x1) ? line->x0 : line->x1,
+                (line->y0 < line->y1) ? line->y0 : line->y1,
+                (line->x0 > line->x1) ? line->x0 : line->x1,
+                (line->y0 > line->y1) ? line->y0 : line->y1
+            );
+        }
+        for (int k = 0; k < overlay->num_markers; k++) {
+            const overlay_marker_t* marker = &overlay_markers[overlay->first_marker + k];
+            grow_overlay_bounds(overlay, marker->x, marker->y, marker->x + 5, marker->y + 5);
+        }
+    }
     
     
     
@@ -316,57 +564,103 @@ void update(void) {
      */
 }
 
+// Draw one triangle of triangles_to_render with the current render method, then the wireframe
+// lines and vertex markers it was handed, within the clip rectangle
+void draw_frame_triangle(uint32_t index, clip_rect_t* clip) {
+    const triangle_t* triangle = &triangles_to_render[index];
+
+    // Draw filled triangle
+    if (render_method == RENDER_FILL_TRIANGLE || render_method == RENDER_FILL_TRIANGLE_WIRE) {
+        draw_filled_triangle_clipped(
+            triangle->points[0].x, triangle->points[0].y, triangle->points[0].z, triangle->points[0].w, // vertex A
+            triangle->points[1].x, triangle->points[1].y, triangle->points[1].z, triangle->points[1].w, // vertex B
+            triangle->points[2].x, triangle->points[2].y, triangle->points[2].z, triangle->points[2].w, // vertex C
+            triangle->color, clip
+        );
+    }
+    // Draw textured triangle
+    if (render_method == RENDER_TEXTURED || render_method == RENDER_TEXTURED_WIRE) {
+        draw_textured_triangle_clipped(
+            triangle->points[0].x, triangle->points[0].y, triangle->points[0].z, triangle->points[0].w, triangle->texcoords[0].u, triangle->texcoords[0].v, // vertex A
+            triangle->points[1].x, triangle->points[1].y, triangle->points[1].z, triangle->points[1].w, triangle->texcoords[1].u, triangle->texcoords[1].v, // vertex B
+            triangle->points[2].x, triangle->points[2].y, triangle->points[2].z, triangle->points[2].w, triangle->texcoords[2].u, triangle->texcoords[2].v, // vertex C
+            (shading_method == SHADING_GOURAUD) ? triangle->intensities : NULL, &mesh_texture, clip
+        );
+    }
+
+    // Draw the wireframe lines and the vertex points over the fill
+    const triangle_overlay_t* overlay = &triangle_overlays[index];
+    for (int i = 0; i < overlay->num_lines; i++) {
+        const overlay_line_t* line = &overlay_lines[overlay->first_line + i];
+        draw_line_clipped(line->x0, line->y0, line->x1, line->y1, 0xFFFFFFFF, clip);
+    }
+    for (int i = 0; i < overlay->num_markers; i++) {
+        const overlay_marker_t* marker = &overlay_markers[overlay->first_marker + i];
+        draw_rect_clipped(marker->x, marker->y, 6, 6, 0xFF0000FF, clip);
+    }
+}
+
 void render(void) {
-    SDL_RenderClear(renderer);
+    if (display_backend == DISPLAY_WINDOW) {
+        SDL_RenderClear(renderer);
+    }
 
 	//draw_grid();
     
  //   /*
     // loop all projected triangles and render them
     int num_triangles = array_length(triangles_to_render);
+    frame_stats.triangles = num_triangles;
     
+    // Every triangle is filled, then gets its wireframe lines and vertex markers drawn over it.
+    // The pixel bounds of both go to the tile bins, and to the dirty rectangle the clears reset.
+    bool fill = render_method == RENDER_FILL_TRIANGLE || render_method == RENDER_FILL_TRIANGLE_WIRE || render_method == RENDER_TEXTURED || render_method == RENDER_TEXTURED_WIRE;
+    bool threaded = tiles_num_threads() > 1;
+    reset_dirty_rect();
+    
+    PROFILE_BEGIN(PROFILE_RASTERIZE);
+    if (threaded) {
+        tiles_begin_frame(window_width, window_height);
+    }
     for (int i = 0; i < num_triangles; i++) {
-        
-        triangle_t triangle = triangles_to_render[i];
-        
-        // Draw filled triangle
-                if (render_method == RENDER_FILL_TRIANGLE || render_method == RENDER_FILL_TRIANGLE_WIRE) {
-                    draw_filled_triangle(
-                        triangle.points[0].x, triangle.points[0].y, // vertex A
-                        triangle.points[1].x, triangle.points[1].y, // vertex B
-                        triangle.points[2].x, triangle.points[2].y, // vertex C
-                        triangle.color
-                    );
-                }
-        // Draw textured triangle
-                if (render_method == RENDER_TEXTURED || render_method == RENDER_TEXTURED_WIRE) {
-                    draw_textured_triangle(
-                        triangle.points[0].x, triangle.points[0].y, triangle.points[0].z, triangle.points[0].w, triangle.texcoords[0].u, triangle.texcoords[0].v, // vertex A
-                        triangle.points[1].x, triangle.points[1].y, triangle.points[1].z, triangle.points[1].w, triangle.texcoords[1].u, triangle.texcoords[1].v, // vertex B
-                        triangle.points[2].x, triangle.points[2].y, triangle.points[2].z, triangle.points[2].w, triangle.texcoords[2].u, triangle.texcoords[2].v, // vertex C
-                        mesh_texture
-                    );
-                }
-        
-        // Draw triangle wireframe
-                if (render_method == RENDER_WIRE || render_method == RENDER_WIRE_VERTEX || render_method == RENDER_FILL_TRIANGLE_WIRE || render_method == RENDER_TEXTURED_WIRE) {
-                    draw_triangle(
-                        triangle.points[0].x, triangle.points[0].y, // vertex A
-                        triangle.points[1].x, triangle.points[1].y, // vertex B
-                        triangle.points[2].x, triangle.points[2].y, // vertex C
-                        0xFFFFFFFF
-                    );
-                }
-
-        
-        // Draw triangle vertex points
-                if (render_method == RENDER_WIRE_VERTEX) {
-                    draw_rect(triangle.points[0].x - 3, triangle.points[0].y - 3, 6, 6, 0xFF0000FF); // vertex A
-                    draw_rect(triangle.points[1].x - 3, triangle.points[1].y - 3, 6, 6, 0xFF0000FF); // vertex B
-                    draw_rect(triangle.points[2].x - 3, triangle.points[2].y - 3, 6, 6, 0xFF0000FF); // vertex C
-                }
-        
+        int order_index = (depth_method == DEPTH_ZBUFFER_FRONT_TO_BACK) ? num_triangles - 1 - i : i;
+        uint32_t index = triangle_order[order_index];
+        const triangle_overlay_t* overlay = &triangle_overlays[index];
+        int x_min = overlay->x_min;
+        int y_min = overlay->y_min;
+        int x_max = overlay->x_max;
+        int y_max = overlay->y_max;
+        if (fill) {
+            const vec4_t* points = triangles_to_render[index].points;
+            int fill_x_min = (int)floorf(fminf(points[0].x, fminf(points[1].x, points[2].x))) - 1;
+            int fill_y_min = (int)floorf(fminf(points[0].y, fminf(points[1].y, points[2].y))) - 1;
+            int fill_x_max = (int)ceilf(fmaxf(points[0].x, fmaxf(points[1].x, points[2].x))) + 1;
+            int fill_y_max = (int)ceilf(fmaxf(points[0].y, fmaxf(points[1].y, points[2].y))) + 1;
+            x_min = (fill_x_min < x_min) ? fill_x_min : x_min;
+            y_min = (fill_y_min < y_min) ? fill_y_min : y_min;
+            x_max = (fill_x_max > x_max) ? fill_x_max : x_max;
+            y_max = (fill_y_max > y_max) ? fill_y_max : y_max;
+        }
+        if (x_min > x_max) {
+            continue;
+        }
+        mark_dirty_rect(x_min, y_min, x_max, y_max);
+        if (threaded) {
+            tiles_bin_triangle(index, x_min, y_min, x_max, y_max);
+        }
+    }
+    if (threaded) {
+        frame_stats.pixels += tiles_draw(draw_frame_triangle);
+    } else {
+        clip_rect_t clip = screen_clip_rect();
+        for (int i = 0; i < num_triangles; i++) {
+            // Front to back lets the z-buffer reject hidden pixels before they are shaded
+            int order_index = (depth_method == DEPTH_ZBUFFER_FRONT_TO_BACK) ? num_triangles - 1 - i : i;
+            draw_frame_triangle(triangle_order[order_index], &clip);
+        }
+        frame_stats.pixels += clip.pixels;
     }
+    PROFILE_END(PROFILE_RASTERIZE);
     
     
     
@@ -404,40 +698,272 @@ void render(void) {
     // Clear the array of triangles to render every frame loop
     array_free(triangles_to_render);
     
-	render_color_buffer();	
-	clear_color_buffer(0xFF000000);
+    PROFILE_SCOPE(PROFILE_PRESENT) {
+        // A frame that could not be written fails the headless run
+        if (!render_color_buffer()) {
+            output_failed = true;
+            is_running = false;
+        }
+    }
+    PROFILE_SCOPE(PROFILE_CLEAR) {
+        clear_color_buffer(0xFF000000);
+        if (depth_method != DEPTH_PAINTER) {
+            clear_z_buffer();
+        }
+    }
 
-	SDL_RenderPresent(renderer);
+    if (display_backend == DISPLAY_WINDOW) {
+        SDL_RenderPresent(renderer);
+    }
 	
 }
 
 // Free the memory that was dynamically allocated by the progra
 void free_resources(void) {
     free(color_buffer);
-    upng_free(png_texture);
-    array_free(mesh.faces);
-    array_free(mesh.vertices);
+    free_png_texture_data();
+    free_mesh_data();
+    free(triangle_order);
+    free_sort_buffers();
+    free(transformed_vertex_buffer);
+    free(projected_vertex_buffer);
+    free(clip_vertex_buffer);
+    free(outcode_buffer);
+    free(vertex_intensity_buffer);
+    free(overlay_lines);
+    free(overlay_markers);
+    free(edge_stamps);
+    free(vertex_stamps);
+    free(triangle_overlays);
+    free(z_buffer);
+    tiles_destroy();
 }
 
 
-int main(void) {
-	/* TODO: Create a SDL window */
+// Print the stage timings and write the trace, both compile to nothing without PROFILE_ENABLED
+void finish_profile(void) {
+    PROFILE_PRINT_SUMMARY(stdout);
+    if (trace_filename != NULL) {
+        PROFILE_WRITE_TRACE(trace_filename);
+    }
+}
+
+void print_usage(const char* program) {
+    printf("Usage: %s [--headless] [--size WIDTHxHEIGHT] [--frames N] [--output PREFIX]\n", program);
+    printf("       %s --bench [--size WIDTHxHEIGHT] [--frames N] [--csv FILE] [--json FILE]\n", program);
+    printf("                  [--baseline FILE] [--tolerance FRACTION] [--allow-missing]\n");
+    printf("       %s --bench-vertex [--frames ITERATIONS]\n", program);
+    printf("  --headless        render into memory only, no window or display needed\n");
+    printf("  --size WxH        headless resolution (default 800x600)\n");
+    printf("  --frames N        number of headless frames to render (default 1, 100 per run with --bench)\n");
+    printf("  --output PREFIX   write headless frames to PREFIX0000.ppm, PREFIX0001.ppm, ...\n");
+    printf("                    (frames are discarded when no prefix is given)\n");
+    printf("  --bench           time every bundled model with every render method, uncapped\n");
+    printf("  --bench-vertex    time the scalar and SIMD vertex transform on drone.obj\n");
+    printf("  --csv FILE        write the benchmark results as CSV\n");
+    printf("  --json FILE       write the benchmark results as JSON\n");
+    printf("  --baseline FILE   compare against the CSV of a previous run, fail when slower\n");
+    printf("  --tolerance F     allowed relative fps drop against the baseline (default 0.1)\n");
+    printf("  --allow-missing   pass when a result or a baseline entry has no match in the other\n");
+    printf("  --trace FILE      write a Chrome trace of the frame stages (make profile builds)\n");
+    printf("  --threads N       rasterize 64x64 screen tiles on N threads, up to 256 (default 0, one per\n");
+    printf("                    CPU core, 1 draws the triangles without binning)\n");
+    printf("  --texture-mapping M\n");
+    printf("                    perspective (default) divides at every textured pixel, subdivided only\n");
+    printf("                    every 16 pixels (keys t and s switch while running)\n");
+    printf("  --no-mipmaps      sample every texture at full resolution (keys m and n switch while running)\n");
+    printf("  --filter F        nearest (default) or bilinear texture sampling (keys v and b)\n");
+    printf("  --shading S       flat (default) leaves the textures unlit, gouraud lights them per vertex\n");
+    printf("                    (keys f and g)\n");
+    printf("  --background B    solid (default) clears to black, grid copies a prebuilt 20 pixel grid\n");
+    printf("  --clear C         full (default) clears the whole screen, dirty only the bounds of the\n");
+    printf("                    last frame's triangles and overlays\n");
+}
+
+// Parse a whole number from min to max, false when the text is anything else
+bool parse_int_option(const char* text, int min, int max, int* value) {
+    char* end = NULL;
+    long parsed = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || parsed < min || parsed > max) {
+        return false;
+    }
+    *value = (int)parsed;
+    return true;
+}
+
+bool parse_arguments(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        bool has_value = (i + 1 < argc);
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[i], "--size") == 0 && has_value) {
+            if (sscanf(argv[++i], "%dx%d", &headless_width, &headless_height) != 2) {
+                fprintf(stderr, "Invalid size '%s', expected WIDTHxHEIGHT.\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            const char* frames = argv[++i];
+            if (!parse_int_option(frames, 1, INT_MAX, &headless_frames)) {
+                fprintf(stderr, "Invalid frame count '%s', expected a positive number.\n", frames);
+                print_usage(argv[0]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && has_value) {
+            headless_output = argv[++i];
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            benchmark = true;
+        } else if (strcmp(argv[i], "--bench-vertex") == 0) {
+            vertex_benchmark = true;
+        } else if (strcmp(argv[i], "--csv") == 0 && has_value) {
+            bench_options.csv_filename = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0 && has_value) {
+            bench_options.json_filename = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && has_value) {
+            bench_options.baseline_filename = argv[++i];
+        } else if (strcmp(argv[i], "--tolerance") == 0 && has_value) {
+            const char* tolerance = argv[++i];
+            char* end = NULL;
+            double value = strtod(tolerance, &end);
+            if (end == tolerance || *end != '\0' || !(value >= 0) || isinf(value)) {
+                fprintf(stderr, "Invalid tolerance '%s', expected a fraction of 0 or more.\n", tolerance);
+                print_usage(argv[0]);
+                return false;
+            }
+            bench_options.tolerance = (float)value;
+        } else if (strcmp(argv[i], "--allow-missing") == 0) {
+            bench_options.allow_missing = true;
+        } else if (strcmp(argv[i], "--trace") == 0 && has_value) {
+            trace_filename = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            const char* threads = argv[++i];
+            if (!parse_int_option(threads, 0, MAX_RENDER_THREADS, &render_threads)) {
+                fprintf(stderr, "Invalid thread count '%s', expected 0 to %d.\n", threads, MAX_RENDER_THREADS);
+                print_usage(argv[0]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--filter") == 0 && has_value) {
+            const char* filter = argv[++i];
+            if (strcmp(filter, "nearest") == 0) {
+                texture_filter = FILTER_NEAREST;
+            } else if (strcmp(filter, "bilinear") == 0) {
+                texture_filter = FILTER_BILINEAR;
+            } else {
+                fprintf(stderr, "Invalid filter '%s', expected nearest or bilinear.\n", filter);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--shading") == 0 && has_value) {
+            const char* shading = argv[++i];
+            if (strcmp(shading, "flat") == 0) {
+                shading_method = SHADING_FLAT;
+            } else if (strcmp(shading, "gouraud") == 0) {
+                shading_method = SHADING_GOURAUD;
+            } else {
+                fprintf(stderr, "Invalid shading '%s', expected flat or gouraud.\n", shading);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--background") == 0 && has_value) {
+            const char* background = argv[++i];
+            if (strcmp(background, "solid") == 0) {
+                background_method = BACKGROUND_SOLID;
+            } else if (strcmp(background, "grid") == 0) {
+                background_method = BACKGROUND_GRID;
+            } else {
+                fprintf(stderr, "Invalid background '%s', expected solid or grid.\n", background);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--clear") == 0 && has_value) {
+            const char* clear = argv[++i];
+            if (strcmp(clear, "full") == 0) {
+                clear_method = CLEAR_FULL;
+            } else if (strcmp(clear, "dirty") == 0) {
+                clear_method = CLEAR_DIRTY;
+            } else {
+                fprintf(stderr, "Invalid clear '%s', expected full or dirty.\n", clear);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--no-mipmaps") == 0) {
+            mipmapping = false;
+        } else if (strcmp(argv[i], "--texture-mapping") == 0 && has_value) {
+            const char* mapping = argv[++i];
+            if (strcmp(mapping, "perspective") == 0) {
+                texture_method = TEXTURE_PERSPECTIVE;
+            } else if (strcmp(mapping, "subdivided") == 0) {
+                texture_method = TEXTURE_SUBDIVIDED;
+            } else {
+                fprintf(stderr, "Invalid texture mapping '%s', expected perspective or subdivided.\n", mapping);
+                return false;
+            }
+        } else {
+            print_usage(argv[0]);
+            return false;
+        }
+    }
+    if (benchmark && headless_frames > 0) {
+        bench_options.frames = headless_frames;
+    }
+    if (vertex_benchmark && headless_frames <= 0) {
+        headless_frames = 1000;
+    }
+    if (headless_frames <= 0) {
+        headless_frames = 1;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (!parse_arguments(argc, argv)) {
+        return 1;
+    }
 	
-	is_running = initialize_window();
+    if (vertex_benchmark) {
+        is_running = initialize_headless(headless_width, headless_height, NULL);
+        bool passed = is_running && run_vertex_benchmark(headless_frames);
+        destroy_window();
+        free_mesh_data();
+        return passed ? 0 : 1;
+    }
+    
+    if (benchmark) {
+        // Benchmark frames are never written out
+        is_running = initialize_headless(headless_width, headless_height, NULL);
+        bool passed = is_running && setup() && run_benchmark(&bench_options, update, render);
+        destroy_window();
+        free_resources();
+        finish_profile();
+        return passed ? 0 : 1;
+    }
+	
+    if (headless) {
+        is_running = initialize_headless(headless_width, headless_height, headless_output);
+    } else {
+        is_running = initialize_window();
+    }
 	
-	setup();
+	bool ready = setup();
     
     
     
+    int frame_count = 0;
 	while (is_running) {
-		process_input();
+        if (display_backend == DISPLAY_WINDOW) {
+            process_input();
+        }
+        PROFILE_FRAME_BEGIN();
 		update();
 		render();
+        PROFILE_FRAME_END();
+        
+        // A headless run stops by itself after the requested number of frames
+        frame_count++;
+        if (display_backend == DISPLAY_HEADLESS && frame_count >= headless_frames) {
+            is_running = false;
+        }
 	}
     
     destroy_window();
     free_resources();
+    finish_profile();
 	
-	return 0;	
+	return (ready && !output_failed) ? 0 : 1;	
 
 }
@@ -1,6 +1,12 @@
 #include <math.h>
 #include "matrix.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 mat4_t mat4_identity(void) {
     // | 1 0 0 0 |
     // | 0 1 0 0 |
@@ -110,6 +116,31 @@ mat4_t mat4_mul_mat4(mat4_t a, mat4_t b) {
 }
 
 
+// Determinant of the upper 3x3 part, negative when the matrix mirrors the geometry
+float mat4_determinant_3x3(mat4_t m) {
+    return m.m[0][0] * (m.m[1][1] * m.m[2][2] - m.m[1][2] * m.m[2][1])
+         - m.m[0][1] * (m.m[1][0] * m.m[2][2] - m.m[1][2] * m.m[2][0])
+         + m.m[0][2] * (m.m[1][0] * m.m[2][1] - m.m[1][1] * m.m[2][0]);
+}
+
+// Inverse of a matrix made of a 3x3 linear part and a translation (the world matrix)
+mat4_t mat4_inverse_affine(mat4_t m) {
+    float inv_det = 1.0 / mat4_determinant_3x3(m);
+    mat4_t r = mat4_identity();
+    r.m[0][0] = (m.m[1][1] * m.m[2][2] - m.m[1][2] * m.m[2][1]) * inv_det;
+    r.m[0][1] = (m.m[0][2] * m.m[2][1] - m.m[0][1] * m.m[2][2]) * inv_det;
+    r.m[0][2] = (m.m[0][1] * m.m[1][2] - m.m[0][2] * m.m[1][1]) * inv_det;
+    r.m[1][0] = (m.m[1][2] * m.m[2][0] - m.m[1][0] * m.m[2][2]) * inv_det;
+    r.m[1][1] = (m.m[0][0] * m.m[2][2] - m.m[0][2] * m.m[2][0]) * inv_det;
+    r.m[1][2] = (m.m[0][2] * m.m[1][0] - m.m[0][0] * m.m[1][2]) * inv_det;
+    r.m[2][0] = (m.m[1][0] * m.m[2][1] - m.m[1][1] * m.m[2][0]) * inv_det;
+    r.m[2][1] = (m.m[0][1] * m.m[2][0] - m.m[0][0] * m.m[2][1]) * inv_det;
+    r.m[2][2] = (m.m[0][0] * m.m[1][1] - m.m[0][1] * m.m[1][0]) * inv_det;
+    for (int i = 0; i < 3; i++) {
+        r.m[i][3] = -(r.m[i][0] * m.m[0][3] + r.m[i][1] * m.m[1][3] + r.m[i][2] * m.m[2][3]);
+    }
+    return r;
+}
 
 // aspect ratio and perspective
 
@@ -142,3 +173,229 @@ vec4_t mat4_mul_vec4_project (mat4_t mat_proj, vec4_t v) {
     return result;
 }
 
+// Project a vertex and map it to a viewport of width x height pixels, with y pointing down
+static vec4_t project_to_screen(const mat4_t* mat_proj, vec4_t v, int width, int height) {
+    vec4_t projected_point = mat4_mul_vec4_project(*mat_proj, v);
+    
+    // invert y values to account flipped screen coordinate
+    projected_point.y *= -1;
+    
+    // scale into the view
+    projected_point.x *= (width / 2.0);
+    projected_point.y *= (height / 2.0);
+    
+    // translate the projected point to the middle of the screen
+    projected_point.x += (width / 2.0);
+    projected_point.y += (height / 2.0);
+    return projected_point;
+}
+
+#if defined(__SSE2__)
+
+// Deinterleave 4 consecutive vec3_t (12 floats) into x, y and z registers
+static inline void load_vec3x4(const vec3_t* points, __m128* x, __m128* y, __m128* z) {
+    const float* f = (const float*)points;
+    __m128 a = _mm_loadu_ps(f);     // x0 y0 z0 x1
+    __m128 b = _mm_loadu_ps(f + 4); // y1 z1 x2 y2
+    __m128 c = _mm_loadu_ps(f + 8); // z2 x3 y3 z3
+    __m128 bc = _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)); // x2 x2 x3 x3
+    *x = _mm_shuffle_ps(a, bc, _MM_SHUFFLE(2, 0, 3, 0));
+    __m128 ab = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)); // y0 y0 y1 y1
+    bc = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3));        // y2 y2 y3 y3
+    *y = _mm_shuffle_ps(ab, bc, _MM_SHUFFLE(2, 0, 2, 0));
+    ab = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2));        // z0 z0 z1 z1
+    __m128 cc = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)); // z2 z2 z3 z3
+    *z = _mm_shuffle_ps(ab, cc, _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+// Transpose x, y, z, w registers back into 4 consecutive vec4_t
+static inline void store_vec4x4(vec4_t* result, __m128 x, __m128 y, __m128 z, __m128 w) {
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    float* f = (float*)result;
+    _mm_storeu_ps(f, x);
+    _mm_storeu_ps(f + 4, y);
+    _mm_storeu_ps(f + 8, z);
+    _mm_storeu_ps(f + 12, w);
+}
+
+#endif
+
+#if defined(__AVX2__)
+
+// The same multiply-add order as mat4_mul_vec4, so the results match it exactly
+#define MAT4_ROW_8(mat, row, x, y, z, w) \
+    _mm256_add_ps(_mm256_add_ps(_mm256_add_ps( \
+        _mm256_mul_ps(_mm256_set1_ps((mat)->m[row][0]), x), \
+        _mm256_mul_ps(_mm256_set1_ps((mat)->m[row][1]), y)), \
+        _mm256_mul_ps(_mm256_set1_ps((mat)->m[row][2]), z)), \
+        _mm256_mul_ps(_mm256_set1_ps((mat)->m[row][3]), w))
+
+static inline __m256 combine_m128(__m128 lo, __m128 hi) {
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+}
+
+static inline void store_vec4x8(vec4_t* result, __m256 x, __m256 y, __m256 z, __m256 w) {
+    store_vec4x4(result, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z), _mm256_castps256_ps128(w));
+    store_vec4x4(result + 4, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1), _mm256_extractf128_ps(w, 1));
+}
+
+#elif defined(__SSE2__)
+
+#define MAT4_ROW_4(mat, row, x, y, z, w) \
+    _mm_add_ps(_mm_add_ps(_mm_add_ps( \
+        _mm_mul_ps(_mm_set1_ps((mat)->m[row][0]), x), \
+        _mm_mul_ps(_mm_set1_ps((mat)->m[row][1]), y)), \
+        _mm_mul_ps(_mm_set1_ps((mat)->m[row][2]), z)), \
+        _mm_mul_ps(_mm_set1_ps((mat)->m[row][3]), w))
+
+#endif
+
+// Transform an array of positions (w = 1) by a matrix
+void mat4_mul_vec3_batch(const mat4_t* m, const vec3_t* points, vec4_t* result, int count) {
+    int i = 0;
+#if defined(__AVX2__)
+    __m256 one = _mm256_set1_ps(1.0);
+    for (; i + 8 <= count; i += 8) {
+        __m128 x0, y0, z0, x1, y1, z1;
+        load_vec3x4(&points[i], &x0, &y0, &z0);
+        load_vec3x4(&points[i + 4], &x1, &y1, &z1);
+        __m256 x = combine_m128(x0, x1);
+        __m256 y = combine_m128(y0, y1);
+        __m256 z = combine_m128(z0, z1);
+        store_vec4x8(&result[i],
+            MAT4_ROW_8(m, 0, x, y, z, one),
+            MAT4_ROW_8(m, 1, x, y, z, one),
+            MAT4_ROW_8(m, 2, x, y, z, one),
+            MAT4_ROW_8(m, 3, x, y, z, one)
+        );
+    }
+#elif defined(__SSE2__)
+    __m128 one = _mm_set1_ps(1.0);
+    for (; i + 4 <= count; i += 4) {
+        __m128 x, y, z;
+        load_vec3x4(&points[i], &x, &y, &z);
+        store_vec4x4(&result[i],
+            MAT4_ROW_4(m, 0, x, y, z, one),
+            MAT4_ROW_4(m, 1, x, y, z, one),
+            MAT4_ROW_4(m, 2, x, y, z, one),
+            MAT4_ROW_4(m, 3, x, y, z, one)
+        );
+    }
+#endif
+    for (; i < count; i++) {
+        result[i] = mat4_mul_vec4(*m, vec4_from_vec3(points[i]));
+    }
+}
+
+// Same as mat4_mul_vec3_batch for positions stored as separate x, y and z arrays. The arrays
+// must be 32-byte aligned (16 for SSE2) so the loads need no shuffling.
+void mat4_mul_soa_batch(const mat4_t* m, const float* xs, const float* ys, const float* zs, vec4_t* result, int count) {
+    int i = 0;
+#if defined(__AVX2__)
+    __m256 one = _mm256_set1_ps(1.0);
+    for (; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_load_ps(&xs[i]);
+        __m256 y = _mm256_load_ps(&ys[i]);
+        __m256 z = _mm256_load_ps(&zs[i]);
+        store_vec4x8(&result[i],
+            MAT4_ROW_8(m, 0, x, y, z, one),
+            MAT4_ROW_8(m, 1, x, y, z, one),
+            MAT4_ROW_8(m, 2, x, y, z, one),
+            MAT4_ROW_8(m, 3, x, y, z, one)
+        );
+    }
+#elif defined(__SSE2__)
+    __m128 one = _mm_set1_ps(1.0);
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_load_ps(&xs[i]);
+        __m128 y = _mm_load_ps(&ys[i]);
+        __m128 z = _mm_load_ps(&zs[i]);
+        store_vec4x4(&result[i],
+            MAT4_ROW_4(m, 0, x, y, z, one),
+            MAT4_ROW_4(m, 1, x, y, z, one),
+            MAT4_ROW_4(m, 2, x, y, z, one),
+            MAT4_ROW_4(m, 3, x, y, z, one)
+        );
+    }
+#endif
+    for (; i < count; i++) {
+        result[i] = mat4_mul_vec4(*m, (vec4_t){ xs[i], ys[i], zs[i], 1.0 });
+    }
+}
+
+// Project an array of vertices, divide by w and map them to a width x height viewport (y down).
+// When clip is not NULL it also receives the clip space points, before the divide.
+void mat4_project_to_screen_batch(const mat4_t* mat_proj, const vec4_t* points, vec4_t* result, vec4_t* clip, int count, int width, int height) {
+    int i = 0;
+#if defined(__AVX2__)
+    __m256 half_width = _mm256_set1_ps(width / 2.0);
+    __m256 half_height = _mm256_set1_ps(height / 2.0);
+    __m256 zero = _mm256_setzero_ps();
+    __m256 minus_one = _mm256_set1_ps(-1.0);
+    for (; i + 8 <= count; i += 8) {
+        const float* f = (const float*)&points[i];
+        __m128 x0 = _mm_loadu_ps(f), y0 = _mm_loadu_ps(f + 4), z0 = _mm_loadu_ps(f + 8), w0 = _mm_loadu_ps(f + 12);
+        __m128 x1 = _mm_loadu_ps(f + 16), y1 = _mm_loadu_ps(f + 20), z1 = _mm_loadu_ps(f + 24), w1 = _mm_loadu_ps(f + 28);
+        _MM_TRANSPOSE4_PS(x0, y0, z0, w0);
+        _MM_TRANSPOSE4_PS(x1, y1, z1, w1);
+        __m256 x = combine_m128(x0, x1);
+        __m256 y = combine_m128(y0, y1);
+        __m256 z = combine_m128(z0, z1);
+        __m256 w = combine_m128(w0, w1);
+
+        __m256 px = MAT4_ROW_8(mat_proj, 0, x, y, z, w);
+        __m256 py = MAT4_ROW_8(mat_proj, 1, x, y, z, w);
+        __m256 pz = MAT4_ROW_8(mat_proj, 2, x, y, z, w);
+        __m256 pw = MAT4_ROW_8(mat_proj, 3, x, y, z, w);
+        if (clip != NULL) {
+            store_vec4x8(&clip[i], px, py, pz, pw);
+        }
+
+        // Perspective divide, skipped where w is 0
+        __m256 has_w = _mm256_cmp_ps(pw, zero, _CMP_NEQ_UQ);
+        px = _mm256_blendv_ps(px, _mm256_div_ps(px, pw), has_w);
+        py = _mm256_blendv_ps(py, _mm256_div_ps(py, pw), has_w);
+        pz = _mm256_blendv_ps(pz, _mm256_div_ps(pz, pw), has_w);
+
+        // Flip y, scale into the view and move to the middle of the screen
+        px = _mm256_add_ps(_mm256_mul_ps(px, half_width), half_width);
+        py = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(py, minus_one), half_height), half_height);
+        store_vec4x8(&result[i], px, py, pz, pw);
+    }
+#elif defined(__SSE2__)
+    __m128 half_width = _mm_set1_ps(width / 2.0);
+    __m128 half_height = _mm_set1_ps(height / 2.0);
+    __m128 zero = _mm_setzero_ps();
+    __m128 minus_one = _mm_set1_ps(-1.0);
+    for (; i + 4 <= count; i += 4) {
+        const float* f = (const float*)&points[i];
+        __m128 x = _mm_loadu_ps(f), y = _mm_loadu_ps(f + 4), z = _mm_loadu_ps(f + 8), w = _mm_loadu_ps(f + 12);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+
+        __m128 px = MAT4_ROW_4(mat_proj, 0, x, y, z, w);
+        __m128 py = MAT4_ROW_4(mat_proj, 1, x, y, z, w);
+        __m128 pz = MAT4_ROW_4(mat_proj, 2, x, y, z, w);
+        __m128 pw = MAT4_ROW_4(mat_proj, 3, x, y, z, w);
+        if (clip != NULL) {
+            store_vec4x4(&clip[i], px, py, pz, pw);
+        }
+
+        // Perspective divide, skipped where w is 0
+        __m128 has_w = _mm_cmpneq_ps(pw, zero);
+        px = _mm_or_ps(_mm_and_ps(has_w, _mm_div_ps(px, pw)), _mm_andnot_ps(has_w, px));
+        py = _mm_or_ps(_mm_and_ps(has_w, _mm_div_ps(py, pw)), _mm_andnot_ps(has_w, py));
+        pz = _mm_or_ps(_mm_and_ps(has_w, _mm_div_ps(pz, pw)), _mm_andnot_ps(has_w, pz));
+
+        // Flip y, scale into the view and move to the middle of the screen
+        px = _mm_add_ps(_mm_mul_ps(px, half_width), half_width);
+        py = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(py, minus_one), half_height), half_height);
+        store_vec4x4(&result[i], px, py, pz, pw);
+    }
+#endif
+    for (; i < count; i++) {
+        if (clip != NULL) {
+            clip[i] = mat4_mul_vec4(*mat_proj, points[i]);
+        }
+        result[i] = project_to_screen(mat_proj, points[i], width, height);
+    }
+}
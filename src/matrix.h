@@ -19,8 +19,17 @@ vec4_t mat4_mul_vec4(mat4_t m, vec4_t v);
 
 mat4_t mat4_mul_mat4(mat4_t a, mat4_t b);
 
+float mat4_determinant_3x3(mat4_t m);
+mat4_t mat4_inverse_affine(mat4_t m);
+
 mat4_t mat4_make_perspective(float fov, float aspect, float znear, float zfar);
 
 vec4_t mat4_mul_vec4_project (mat4_t mat_proj, vec4_t v);
 
+// Batch versions working on whole arrays, 8 (AVX2) or 4 (SSE2) vertices per iteration
+// with a scalar fallback, giving the same results as the per-vertex functions
+void mat4_mul_vec3_batch(const mat4_t* m, const vec3_t* points, vec4_t* result, int count);
+void mat4_mul_soa_batch(const mat4_t* m, const float* xs, const float* ys, const float* zs, vec4_t* result, int count);
+void mat4_project_to_screen_batch(const mat4_t* mat_proj, const vec4_t* points, vec4_t* result, vec4_t* clip, int count, int width, int height);
+
 #endif
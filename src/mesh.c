@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 #include <string.h>
 #include "array.h"
 #include "mesh.h"
@@ -7,9 +9,14 @@
 mesh_t mesh = {
     .vertices = NULL,
     .faces = NULL,
-    .rotation = { 0, 0, 0 },
-    .scale = { 1.0, 1.0, 1.0 },
-    .translation = { 0, 0, 0 }
+    .normals = NULL,
+    .transform = {
+        .rotation = { 0, 0, 0 },
+        .scale = { 1.0, 1.0, 1.0 },
+        .translation = { 0, 0, 0 },
+        .dirty = true,
+        .wvp_dirty = true
+    }
 };
 
 
@@ -105,14 +112,19 @@ void load_cube_mesh_data(void) {
         face_t cube_face = cube_faces[i];
         array_push(mesh.faces, cube_face);
     }
-    
+    build_mesh_soa();
+    compute_mesh_bounds();
 }
 
-void load_obj_file_data(char* filename) {
+bool load_obj_file_data(char* filename) {
     // Read the contents of the .ob.i file
     // and load the vertices and faces in our mesh.vertices and mesh.faces
     FILE* file;
     file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error opening %s.\n", filename);
+        return false;
+    }
     char line[1024];
     
     tex2_t* texcoords = NULL;
@@ -126,6 +138,13 @@ void load_obj_file_data(char* filename) {
             array_push(mesh.vertices, vertex);
         }
         
+        // Vertex normal information
+        if (strncmp(line, "vn ", 3) == 0) {
+            vec3_t normal;
+            sscanf(line, "vn %f %f %f", &normal.x, &normal.y, &normal.z);
+            array_push(mesh.normals, normal);
+        }
+        
         // Texture Coordinates information
         if (strncmp(line, "vt ", 3) == 0) {
             tex2_t texcoord;
@@ -137,7 +156,7 @@ void load_obj_file_data(char* filename) {
         if (strncmp(line, "f ", 2) == 0) {
             int vertex_indices[3];
             int texture_indices[3];
-            int normal_indices[3];
+            int normal_indices[3] = { 0, 0, 0 };
             sscanf(line, "f %d/%d/%d %d/%d/%d %d/%d/%d",
                    &vertex_indices[0], &texture_indices[0], &normal_indices[0],
                    &vertex_indices[1], &texture_indices[1], &normal_indices[1],
@@ -150,6 +169,9 @@ void load_obj_file_data(char* filename) {
                 .a_uv = texcoords[texture_indices[0] - 1],
                 .b_uv = texcoords[texture_indices[1] - 1],
                 .c_uv = texcoords[texture_indices[2] - 1],
+                .a_normal = normal_indices[0],
+                .b_normal = normal_indices[1],
+                .c_normal = normal_indices[2],
                 .color = 0xFFFFFFFF
             };
             array_push(mesh.faces, face);
@@ -157,4 +179,243 @@ void load_obj_file_data(char* filename) {
     }
     
     //array_free(texcoords);
+    fclose(file);
+    build_mesh_soa();
+    compute_mesh_bounds();
+    return true;
+}
+
+// Box around all vertices, and a sphere centered on the box that holds every vertex
+void compute_mesh_bounds(void) {
+    mesh_bounds_t bounds = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, 0 };
+    int num_vertices = array_length(mesh.vertices);
+    if (num_vertices > 0) {
+        bounds.min = bounds.max = mesh.vertices[0];
+    }
+    for (int i = 1; i < num_vertices; i++) {
+        vec3_t v = mesh.vertices[i];
+        bounds.min = (vec3_t){ fminf(bounds.min.x, v.x), fminf(bounds.min.y, v.y), fminf(bounds.min.z, v.z) };
+        bounds.max = (vec3_t){ fmaxf(bounds.max.x, v.x), fmaxf(bounds.max.y, v.y), fmaxf(bounds.max.z, v.z) };
+    }
+    bounds.center = vec3_mul(vec3_add(bounds.min, bounds.max), 0.5);
+    for (int i = 0; i < num_vertices; i++) {
+        bounds.radius = fmaxf(bounds.radius, vec3_length(vec3_sub(mesh.vertices[i], bounds.center)));
+    }
+    mesh.bounds = bounds;
+}
+
+// Allocate memory aligned to 32 bytes for SIMD loads, the original pointer is kept right before it
+static void* aligned_malloc(size_t size) {
+    uint8_t* base = (uint8_t*) malloc(size + 32 + sizeof(void*));
+    if (!base) {
+        return NULL;
+    }
+    uintptr_t aligned = ((uintptr_t)(base + sizeof(void*)) + 31) & ~(uintptr_t)31;
+    ((void**)aligned)[-1] = base;
+    return (void*)aligned;
+}
+
+static void aligned_free(void* pointer) {
+    if (pointer != NULL) {
+        free(((void**)pointer)[-1]);
+    }
+}
+
+static void free_mesh_soa(mesh_soa_t* soa) {
+    aligned_free(soa->x);
+    aligned_free(soa->y);
+    aligned_free(soa->z);
+    free(soa->indices);
+    free(soa->u);
+    free(soa->v);
+    free(soa->uv_indices);
+    free(soa->colors);
+    free(soa->nx);
+    free(soa->ny);
+    free(soa->nz);
+    free(soa->nd);
+    free(soa->vnx);
+    free(soa->vny);
+    free(soa->vnz);
+    free(soa->normal_indices);
+    free(soa->edges);
+    free(soa->face_edges);
+    memset(soa, 0, sizeof(mesh_soa_t));
+}
+
+// Return the index of a texture coordinate in u/v, appending it when it is not there yet.
+// The hash table maps the bits of (u, v) to index + 1, with 0 marking an empty slot.
+static uint32_t add_unique_uv(mesh_soa_t* soa, uint32_t* table, uint32_t table_mask, tex2_t uv) {
+    uint32_t u_bits, v_bits;
+    memcpy(&u_bits, &uv.u, sizeof(u_bits));
+    memcpy(&v_bits, &uv.v, sizeof(v_bits));
+    uint32_t slot = (u_bits * 0x9E3779B1u ^ v_bits * 0x85EBCA77u) & table_mask;
+    while (table[slot] != 0) {
+        uint32_t index = table[slot] - 1;
+        if (memcmp(&soa->u[index], &uv.u, sizeof(float)) == 0 && memcmp(&soa->v[index], &uv.v, sizeof(float)) == 0) {
+            return index;
+        }
+        slot = (slot + 1) & table_mask;
+    }
+    uint32_t index = soa->num_uvs++;
+    soa->u[index] = uv.u;
+    soa->v[index] = uv.v;
+    table[slot] = index + 1;
+    return index;
+}
+
+// Same as add_unique_uv for the edge between vertices a and b, in either direction
+static uint32_t add_unique_edge(mesh_soa_t* soa, uint32_t* table, uint32_t table_mask, uint32_t a, uint32_t b) {
+    if (a > b) {
+        uint32_t swap = a;
+        a = b;
+        b = swap;
+    }
+    uint32_t slot = (a * 0x9E3779B1u ^ b * 0x85EBCA77u) & table_mask;
+    while (table[slot] != 0) {
+        uint32_t index = table[slot] - 1;
+        if (soa->edges[index * 2] == a && soa->edges[index * 2 + 1] == b) {
+            return index;
+        }
+        slot = (slot + 1) & table_mask;
+    }
+    uint32_t index = soa->num_edges++;
+    soa->edges[index * 2] = a;
+    soa->edges[index * 2 + 1] = b;
+    table[slot] = index + 1;
+    return index;
+}
+
+// Normals lit once per vertex by the Gouraud shading. The vn normals of the file are used when
+// every face has them, otherwise each vertex gets the sum of the face normals around it, which
+// weights every face by its area since the face normals are not normalized.
+static void build_vertex_normals(mesh_soa_t* soa) {
+    int num_file_normals = array_length(mesh.normals);
+    bool file_normals = num_file_normals > 0;
+    for (int i = 0; i < soa->num_faces && file_normals; i++) {
+        face_t face = mesh.faces[i];
+        file_normals =
+            face.a_normal >= 1 && face.a_normal <= num_file_normals &&
+            face.b_normal >= 1 && face.b_normal <= num_file_normals &&
+            face.c_normal >= 1 && face.c_normal <= num_file_normals;
+    }
+
+    int num_corners = soa->num_faces * 3;
+    soa->num_normals = file_normals ? num_file_normals : soa->num_vertices;
+    soa->vnx = (float*) calloc(soa->num_normals + 1, sizeof(float));
+    soa->vny = (float*) calloc(soa->num_normals + 1, sizeof(float));
+    soa->vnz = (float*) calloc(soa->num_normals + 1, sizeof(float));
+    soa->normal_indices = (uint32_t*) malloc(sizeof(uint32_t) * (num_corners + 1));
+
+    if (file_normals) {
+        for (int i = 0; i < soa->num_normals; i++) {
+            soa->vnx[i] = mesh.normals[i].x;
+            soa->vny[i] = mesh.normals[i].y;
+            soa->vnz[i] = mesh.normals[i].z;
+        }
+        for (int i = 0; i < soa->num_faces; i++) {
+            soa->normal_indices[i * 3 + 0] = mesh.faces[i].a_normal - 1;
+            soa->normal_indices[i * 3 + 1] = mesh.faces[i].b_normal - 1;
+            soa->normal_indices[i * 3 + 2] = mesh.faces[i].c_normal - 1;
+        }
+    } else {
+        for (int i = 0; i < num_corners; i++) {
+            uint32_t vertex = soa->indices[i];
+            soa->vnx[vertex] += soa->nx[i / 3];
+            soa->vny[vertex] += soa->ny[i / 3];
+            soa->vnz[vertex] += soa->nz[i / 3];
+            soa->normal_indices[i] = vertex;
+        }
+    }
+
+    for (int i = 0; i < soa->num_normals; i++) {
+        float length = sqrtf(soa->vnx[i] * soa->vnx[i] + soa->vny[i] * soa->vny[i] + soa->vnz[i] * soa->vnz[i]);
+        if (length > 0) {
+            soa->vnx[i] /= length;
+            soa->vny[i] /= length;
+            soa->vnz[i] /= length;
+        }
+    }
+}
+
+// Convert mesh.vertices and mesh.faces into the structure-of-arrays layout
+void build_mesh_soa(void) {
+    mesh_soa_t* soa = &mesh.soa;
+    free_mesh_soa(soa);
+
+    soa->num_vertices = array_length(mesh.vertices);
+    soa->num_faces = array_length(mesh.faces);
+
+    int padded_vertices = (soa->num_vertices + 7) & ~7;
+    soa->x = (float*) aligned_malloc(sizeof(float) * padded_vertices);
+    soa->y = (float*) aligned_malloc(sizeof(float) * padded_vertices);
+    soa->z = (float*) aligned_malloc(sizeof(float) * padded_vertices);
+    for (int i = 0; i < padded_vertices; i++) {
+        vec3_t vertex = (i < soa->num_vertices) ? mesh.vertices[i] : (vec3_t){ 0, 0, 0 };
+        soa->x[i] = vertex.x;
+        soa->y[i] = vertex.y;
+        soa->z[i] = vertex.z;
+    }
+
+    int num_corners = soa->num_faces * 3;
+    soa->indices = (uint32_t*) malloc(sizeof(uint32_t) * (num_corners + 1));
+    soa->uv_indices = (uint32_t*) malloc(sizeof(uint32_t) * (num_corners + 1));
+    soa->colors = (uint32_t*) malloc(sizeof(uint32_t) * (soa->num_faces + 1));
+    soa->u = (float*) malloc(sizeof(float) * (num_corners + 1));
+    soa->v = (float*) malloc(sizeof(float) * (num_corners + 1));
+    soa->nx = (float*) malloc(sizeof(float) * (soa->num_faces + 1));
+    soa->ny = (float*) malloc(sizeof(float) * (soa->num_faces + 1));
+    soa->nz = (float*) malloc(sizeof(float) * (soa->num_faces + 1));
+    soa->nd = (float*) malloc(sizeof(float) * (soa->num_faces + 1));
+
+    uint32_t table_size = 1;
+    while (table_size < (uint32_t)num_corners * 2) {
+        table_size <<= 1;
+    }
+    uint32_t* table = (uint32_t*) calloc(table_size, sizeof(uint32_t));
+
+    for (int i = 0; i < soa->num_faces; i++) {
+        face_t face = mesh.faces[i];
+        soa->indices[i * 3 + 0] = face.a - 1;
+        soa->indices[i * 3 + 1] = face.b - 1;
+        soa->indices[i * 3 + 2] = face.c - 1;
+        soa->uv_indices[i * 3 + 0] = add_unique_uv(soa, table, table_size - 1, face.a_uv);
+        soa->uv_indices[i * 3 + 1] = add_unique_uv(soa, table, table_size - 1, face.b_uv);
+        soa->uv_indices[i * 3 + 2] = add_unique_uv(soa, table, table_size - 1, face.c_uv);
+        soa->colors[i] = face.color;
+
+        // The face plane only depends on the static mesh, so the culling test needs no per-frame normal
+        vec3_t a = mesh.vertices[face.a - 1];
+        vec3_t normal = vec3_cross(vec3_sub(mesh.vertices[face.b - 1], a), vec3_sub(mesh.vertices[face.c - 1], a));
+        soa->nx[i] = normal.x;
+        soa->ny[i] = normal.y;
+        soa->nz[i] = normal.z;
+        soa->nd[i] = vec3_dot(normal, a);
+    }
+
+    // Edges for the wireframe, the table is reused since no edge outnumbers the face corners
+    memset(table, 0, sizeof(uint32_t) * table_size);
+    soa->edges = (uint32_t*) malloc(sizeof(uint32_t) * 2 * (num_corners + 1));
+    soa->face_edges = (uint32_t*) malloc(sizeof(uint32_t) * (num_corners + 1));
+    for (int i = 0; i < soa->num_faces; i++) {
+        const uint32_t* face = &soa->indices[i * 3];
+        soa->face_edges[i * 3 + 0] = add_unique_edge(soa, table, table_size - 1, face[0], face[1]);
+        soa->face_edges[i * 3 + 1] = add_unique_edge(soa, table, table_size - 1, face[1], face[2]);
+        soa->face_edges[i * 3 + 2] = add_unique_edge(soa, table, table_size - 1, face[2], face[0]);
+    }
+    free(table);
+    build_vertex_normals(soa);
+}
+
+// Release the mesh arrays and reset its transform so another model can be loaded
+void free_mesh_data(void) {
+    array_free(mesh.faces);
+    array_free(mesh.vertices);
+    array_free(mesh.normals);
+    mesh.faces = NULL;
+    mesh.vertices = NULL;
+    mesh.normals = NULL;
+    free_mesh_soa(&mesh.soa);
+    memset(&mesh.bounds, 0, sizeof(mesh_bounds_t));
+    transform_init(&mesh.transform);
 }
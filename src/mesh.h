@@ -1,9 +1,12 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "vector.h"
 //#include <stdint.h>
 #include "triangle.h"
+#include "transform.h"
 
 
 #define N_CUBE_VERTICES 8
@@ -12,13 +15,49 @@
 extern vec3_t cube_vertices[N_CUBE_VERTICES]; // 8x cube
 extern face_t cube_faces[N_CUBE_FACES];
 
+// Structure-of-arrays copy of the mesh, built at load time for the per-frame stages
+typedef struct {
+    int num_vertices;
+    int num_faces;
+    int num_uvs;
+    float* x; // vertex positions, 32-byte aligned and zero padded to a multiple of 8
+    float* y;
+    float* z;
+    uint32_t* indices; // 3 zero-based vertex indices per face
+    float* u; // deduplicated texture coordinates
+    float* v;
+    uint32_t* uv_indices; // 3 indices into u and v per face
+    uint32_t* colors; // one color per face
+    float* nx; // unnormalized object-space face normals, cross(b - a, c - a)
+    float* ny;
+    float* nz;
+    float* nd; // plane distance of each face, dot(normal, a)
+    int num_normals;
+    float* vnx; // unit object-space vertex normals for the Gouraud shading
+    float* vny;
+    float* vnz;
+    uint32_t* normal_indices; // 3 indices into vnx, vny and vnz per face
+    int num_edges;
+    uint32_t* edges; // 2 vertex indices per edge, every edge shared by faces appears once
+    uint32_t* face_edges; // 3 indices into edges per face, for the edges ab, bc and ca
+} mesh_soa_t;
+
+// Bounding volumes of the mesh in object space, computed at load time
+typedef struct {
+    vec3_t min; // axis aligned bounding box
+    vec3_t max;
+    vec3_t center; // bounding sphere
+    float radius;
+} mesh_bounds_t;
+
 // Define a struct for dynamic size meshes, with array of vertices and faces
 typedef struct {
     vec3_t* vertices; // dynamic array of vertices
     face_t* faces;  // dynanic array of faces
-    vec3_t rotation; // rotation with ×, y, and z values
-    vec3_t scale; // scale with x, y, z, values
-    vec3_t translation; // translation with x, y, z, values
+    vec3_t* normals; // dynamic array of the vn normals, NULL when the file has none
+    mesh_soa_t soa; // the same vertices and faces as separate arrays
+    mesh_bounds_t bounds;
+    transform_t transform; // rotation, scale and translation with the cached world matrix
     
 } mesh_t;
 
@@ -27,6 +66,12 @@ extern mesh_t mesh;
 
 void load_cube_mesh_data(void);
 
-void load_obj_file_data(char* filename);
+bool load_obj_file_data(char* filename);
+
+void build_mesh_soa(void);
+
+void compute_mesh_bounds(void);
+
+void free_mesh_data(void);
 
 #endif
@@ -0,0 +1,142 @@
+#include "profile.h"
+
+#ifdef PROFILE_ENABLED
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char* profile_stage_names[PROFILE_NUM_STAGES] = {
+    "world_transform",
+    "backface_cull",
+    "projection",
+    "clipping",
+    "depth_sort",
+    "rasterize",
+    "present",
+    "clear"
+};
+
+profile_frame_t profile_frame;
+uint64_t profile_stage_open[PROFILE_NUM_STAGES];
+
+// Ring buffer with the last PROFILE_MAX_FRAMES finished frames
+static profile_frame_t profile_frames[PROFILE_MAX_FRAMES];
+static int profile_frame_count = 0;
+
+void profile_frame_begin(void) {
+    memset(&profile_frame, 0, sizeof(profile_frame));
+    profile_frame.start = SDL_GetPerformanceCounter();
+}
+
+void profile_frame_end(void) {
+    profile_frame.duration = SDL_GetPerformanceCounter() - profile_frame.start;
+    profile_frames[profile_frame_count % PROFILE_MAX_FRAMES] = profile_frame;
+    profile_frame_count++;
+}
+
+static int profile_num_frames(void) {
+    return (profile_frame_count < PROFILE_MAX_FRAMES) ? profile_frame_count : PROFILE_MAX_FRAMES;
+}
+
+// Oldest frame first
+static profile_frame_t* profile_get_frame(int i) {
+    int first = (profile_frame_count < PROFILE_MAX_FRAMES) ? 0 : profile_frame_count % PROFILE_MAX_FRAMES;
+    return &profile_frames[(first + i) % PROFILE_MAX_FRAMES];
+}
+
+static double profile_ticks_to_ms(uint64_t ticks) {
+    return (double)ticks * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+static int compare_ticks(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of an ascending array
+static uint64_t percentile(const uint64_t* sorted, int count, int p) {
+    int rank = (p * count + 99) / 100;
+    if (rank < 1) rank = 1;
+    return sorted[rank - 1];
+}
+
+static void print_row(FILE* file, const char* name, uint64_t* samples, int count) {
+    uint64_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += samples[i];
+    }
+    qsort(samples, count, sizeof(uint64_t), compare_ticks);
+    fprintf(file, "%-16s %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+        name,
+        profile_ticks_to_ms(total) / count,
+        profile_ticks_to_ms(percentile(samples, count, 50)),
+        profile_ticks_to_ms(percentile(samples, count, 95)),
+        profile_ticks_to_ms(percentile(samples, count, 99)),
+        profile_ticks_to_ms(samples[count - 1])
+    );
+}
+
+void profile_print_summary(FILE* file) {
+    int count = profile_num_frames();
+    if (count == 0) {
+        return;
+    }
+    uint64_t* samples = (uint64_t*) malloc(sizeof(uint64_t) * count);
+    if (!samples) {
+        return;
+    }
+
+    fprintf(file, "Frame profile over the last %d frames (ms)\n", count);
+    fprintf(file, "%-16s %10s %10s %10s %10s %10s\n", "stage", "mean", "p50", "p95", "p99", "max");
+    for (int stage = 0; stage < PROFILE_NUM_STAGES; stage++) {
+        for (int i = 0; i < count; i++) {
+            samples[i] = profile_get_frame(i)->stage_total[stage];
+        }
+        print_row(file, profile_stage_names[stage], samples, count);
+    }
+    for (int i = 0; i < count; i++) {
+        samples[i] = profile_get_frame(i)->duration;
+    }
+    print_row(file, "frame", samples, count);
+
+    free(samples);
+}
+
+// Write the frames as complete ("X") events of the Chrome trace_event format, for chrome://tracing
+// or Perfetto. Per-face stages show up as one event at their first sample, lasting their summed time.
+int profile_write_chrome_trace(const char* filename) {
+    FILE* file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "Error opening %s for writing.\n", filename);
+        return 0;
+    }
+    int count = profile_num_frames();
+    uint64_t origin = (count > 0) ? profile_get_frame(0)->start : 0;
+    double us_per_tick = 1000000.0 / (double)SDL_GetPerformanceFrequency();
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"frames\"}},\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"stages\"}}");
+    for (int i = 0; i < count; i++) {
+        profile_frame_t* frame = profile_get_frame(i);
+        fprintf(file, ",\n{\"name\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%d}}",
+            (frame->start - origin) * us_per_tick, frame->duration * us_per_tick, profile_frame_count - count + i
+        );
+        for (int stage = 0; stage < PROFILE_NUM_STAGES; stage++) {
+            if (frame->stage_samples[stage] == 0) {
+                continue;
+            }
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"samples\":%d}}",
+                profile_stage_names[stage],
+                (frame->stage_start[stage] - origin) * us_per_tick,
+                frame->stage_total[stage] * us_per_tick,
+                frame->stage_samples[stage]
+            );
+        }
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Frame stages timed by the profiler
+enum profile_stage {
+    PROFILE_WORLD_TRANSFORM,
+    PROFILE_BACKFACE_CULL,
+    PROFILE_PROJECTION,
+    PROFILE_CLIPPING,
+    PROFILE_DEPTH_SORT,
+    PROFILE_RASTERIZE,
+    PROFILE_PRESENT,
+    PROFILE_CLEAR,
+    PROFILE_NUM_STAGES
+};
+
+// Number of most recent frames kept for the summary and the trace
+#define PROFILE_MAX_FRAMES 1024
+
+///////////////////////////////////////////////////////////////////////////////
+// The profiler only exists when building with -DPROFILE_ENABLED (make profile),
+// otherwise every macro below compiles to nothing
+///////////////////////////////////////////////////////////////////////////////
+#ifdef PROFILE_ENABLED
+
+#include <SDL2/SDL.h>
+
+typedef struct {
+    uint64_t start;                                // counter when the frame began
+    uint64_t duration;
+    uint64_t stage_start[PROFILE_NUM_STAGES];      // counter at the first sample of each stage
+    uint64_t stage_total[PROFILE_NUM_STAGES];      // sum of all samples of each stage
+    int stage_samples[PROFILE_NUM_STAGES];
+} profile_frame_t;
+
+extern profile_frame_t profile_frame;
+extern uint64_t profile_stage_open[PROFILE_NUM_STAGES];
+
+static inline void profile_begin(int stage) {
+    profile_stage_open[stage] = SDL_GetPerformanceCounter();
+}
+
+// Stages that run once per face add up into a single sample for the frame
+static inline void profile_end(int stage) {
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (profile_frame.stage_samples[stage]++ == 0) {
+        profile_frame.stage_start[stage] = profile_stage_open[stage];
+    }
+    profile_frame.stage_total[stage] += now - profile_stage_open[stage];
+}
+
+void profile_frame_begin(void);
+void profile_frame_end(void);
+void profile_print_summary(FILE* file);
+int profile_write_chrome_trace(const char* filename);
+
+#define PROFILE_BEGIN(stage) profile_begin(stage)
+#define PROFILE_END(stage) profile_end(stage)
+// Times the statement or block that follows, which must not break or continue out of it
+#define PROFILE_SCOPE(stage) \
+    for (int profile_scope_ = (profile_begin(stage), 1); profile_scope_; profile_scope_ = (profile_end(stage), 0))
+#define PROFILE_FRAME_BEGIN() profile_frame_begin()
+#define PROFILE_FRAME_END() profile_frame_end()
+#define PROFILE_PRINT_SUMMARY(file) profile_print_summary(file)
+#define PROFILE_WRITE_TRACE(filename) profile_write_chrome_trace(filename)
+
+#else
+
+#define PROFILE_BEGIN(stage) ((void)0)
+#define PROFILE_END(stage) ((void)0)
+#define PROFILE_SCOPE(stage)
+#define PROFILE_FRAME_BEGIN() ((void)0)
+#define PROFILE_FRAME_END() ((void)0)
+#define PROFILE_PRINT_SUMMARY(file) ((void)0)
+#define PROFILE_WRITE_TRACE(filename) ((void)fprintf(stderr, "Profiling is disabled, build with make profile to write %s.\n", (filename)))
+
+#endif
+
+#endif
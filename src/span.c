@@ -0,0 +1,622 @@
+#include <stdlib.h>
+#include <math.h>
+#include <SDL2/SDL.h>
+#include "span.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPAN_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Span kernels
+///////////////////////////////////////////////////////////////////////////////
+// Every kernel evaluates pixel i of a span as value + step * i, in the same float operations, so
+// they all write exactly the same pixels. The SIMD kernels are compiled for their instruction set
+// with target attributes and picked at startup from the CPU features, one binary runs everywhere.
+///////////////////////////////////////////////////////////////////////////////
+
+// Texel at non negative texel coordinates, wrapped with a mask on power of two textures
+static inline uint32_t wrapped_texel(const texture_level_t* texture, int tex_x, int tex_y) {
+    if (texture->swizzled) {
+        return texture->texels[texture->swizzle_x[tex_x & texture->width_mask] | texture->swizzle_y[tex_y & texture->height_mask]];
+    }
+    return texture->texels[(texture->width * (tex_y % texture->height)) + (tex_x % texture->width)];
+}
+
+// Blend two RGBA8 texels, weight 0 gives a and 256 gives b. The channels are multiplied two at a
+// time in 32 bits (SWAR), 8 bits of weight can't carry from one channel into the next.
+static inline uint32_t lerp_texels(uint32_t a, uint32_t b, uint32_t weight) {
+    uint32_t red_blue = (a & 0x00FF00FF) * (256 - weight) + (b & 0x00FF00FF) * weight;
+    uint32_t green_alpha = ((a >> 8) & 0x00FF00FF) * (256 - weight) + ((b >> 8) & 0x00FF00FF) * weight;
+    return ((red_blue >> 8) & 0x00FF00FF) | (green_alpha & 0xFF00FF00);
+}
+
+// Wrap a texel coordinate of any sign, repeating the texture
+static inline int repeat_texel(int coordinate, int size) {
+    int r = coordinate % size;
+    return (r < 0) ? r + size : r;
+}
+
+// Blend of the 4 texels around texel space position (x, y), texel centers are at + 0.5
+static inline uint32_t bilinear_texel(const texture_level_t* texture, float x, float y) {
+    x -= 0.5f;
+    y -= 0.5f;
+    float x_floor = floorf(x);
+    float y_floor = floorf(y);
+    uint32_t x_weight = (uint32_t)((x - x_floor) * 256.0f);
+    uint32_t y_weight = (uint32_t)((y - y_floor) * 256.0f);
+    int x0 = (int)x_floor;
+    int y0 = (int)y_floor;
+    uint32_t top_left, top_right, bottom_left, bottom_right;
+    if (texture->swizzled) {
+        uint32_t column0 = texture->swizzle_x[x0 & texture->width_mask];
+        uint32_t column1 = texture->swizzle_x[(x0 + 1) & texture->width_mask];
+        uint32_t row0 = texture->swizzle_y[y0 & texture->height_mask];
+        uint32_t row1 = texture->swizzle_y[(y0 + 1) & texture->height_mask];
+        top_left = texture->texels[column0 | row0];
+        top_right = texture->texels[column1 | row0];
+        bottom_left = texture->texels[column0 | row1];
+        bottom_right = texture->texels[column1 | row1];
+    } else {
+        int column0 = repeat_texel(x0, texture->width);
+        int column1 = repeat_texel(x0 + 1, texture->width);
+        int row0 = texture->width * repeat_texel(y0, texture->height);
+        int row1 = texture->width * repeat_texel(y0 + 1, texture->height);
+        top_left = texture->texels[row0 + column0];
+        top_right = texture->texels[row0 + column1];
+        bottom_left = texture->texels[row1 + column0];
+        bottom_right = texture->texels[row1 + column1];
+    }
+    return lerp_texels(lerp_texels(top_left, top_right, x_weight), lerp_texels(bottom_left, bottom_right, x_weight), y_weight);
+}
+
+// Scale the color channels of a texel by weight / 256 and keep its alpha, red and blue share
+// one multiply like in lerp_texels
+static inline uint32_t modulate_texel(uint32_t texel, uint32_t weight) {
+    uint32_t red_blue = (((texel & 0x00FF00FF) * weight) >> 8) & 0x00FF00FF;
+    uint32_t green = (((texel & 0x0000FF00) * weight) >> 8) & 0x0000FF00;
+    return (texel & 0xFF000000) | red_blue | green;
+}
+
+// Light intensity to a modulate_texel weight, clamped to [0, 256] (NaN gives 0)
+static inline uint32_t intensity_weight(float intensity) {
+    float weight = intensity * 256.0f;
+    weight = (weight > 0) ? weight : 0;
+    weight = (weight < 256) ? weight : 256;
+    return (uint32_t)weight;
+}
+
+// Draw pixels first to count - 1 of the span one at a time
+static inline int draw_textured_pixels(const textured_span_t* span, int first, int count, bool bilinear) {
+    int pixels = 0;
+    for (int i = first; i < count; i++) {
+        float reciprocal_w = span->reciprocal_w + span->reciprocal_w_step * i;
+
+        // Reject the pixel before sampling the texture when something closer was already drawn
+        if (span->depths != NULL) {
+            float depth = 1.0 - reciprocal_w;
+            if (depth >= span->depths[i]) {
+                continue;
+            }
+            span->depths[i] = depth;
+        }
+
+        // Divide back by 1/w to get the perspective correct u and v
+        float u = (span->u_over_w + span->u_over_w_step * i) / reciprocal_w;
+        float v = (span->v_over_w + span->v_over_w_step * i) / reciprocal_w;
+
+        // Map the uv coordinate to the full texture width and height
+        uint32_t texel;
+        if (bilinear) {
+            texel = bilinear_texel(span->texture, u * span->texture->width, v * span->texture->height);
+        } else {
+            int tex_x = abs((int)(u * span->texture->width));
+            int tex_y = abs((int)(v * span->texture->height));
+            texel = wrapped_texel(span->texture, tex_x, tex_y);
+        }
+        if (span->shaded) {
+            float intensity = (span->intensity_over_w + span->intensity_over_w_step * i) / reciprocal_w;
+            texel = modulate_texel(texel, intensity_weight(intensity));
+        }
+        span->pixels[i] = texel;
+        pixels++;
+    }
+    return pixels;
+}
+
+static int draw_textured_span_scalar(const textured_span_t* span, int count) {
+    return draw_textured_pixels(span, 0, count, false);
+}
+
+static int draw_bilinear_span_scalar(const textured_span_t* span, int count) {
+    return draw_textured_pixels(span, 0, count, true);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Subdivided affine texturing, like Quake: the exact texture coordinates are computed once per
+// block, at the first pixel of the next one, and stepped linearly toward them, so the pixels
+// themselves never divide. The end values become the start of the next block. Blocks end on
+// multiples of SUBDIVIDE_SPAN in screen x, which keeps them the same however the span is split
+// into tiles.
+///////////////////////////////////////////////////////////////////////////////
+static inline int draw_subdivided_pixels(const textured_span_t* span, int count, bool bilinear) {
+    int pixels = 0;
+    float u = span->u_over_w / span->reciprocal_w * span->texture->width;
+    float v = span->v_over_w / span->reciprocal_w * span->texture->height;
+    float intensity = span->intensity_over_w / span->reciprocal_w;
+    for (int i = 0; i < count; ) {
+        int block_end = ((span->x + i) / SUBDIVIDE_SPAN + 1) * SUBDIVIDE_SPAN - span->x;
+        if (block_end > count) {
+            block_end = count;
+        }
+        
+        // Texel coordinates and light intensity at the first pixel after the block
+        float end_reciprocal_w = span->reciprocal_w + span->reciprocal_w_step * block_end;
+        float end_u = (span->u_over_w + span->u_over_w_step * block_end) / end_reciprocal_w * span->texture->width;
+        float end_v = (span->v_over_w + span->v_over_w_step * block_end) / end_reciprocal_w * span->texture->height;
+        float end_intensity = (span->intensity_over_w + span->intensity_over_w_step * block_end) / end_reciprocal_w;
+        float u_step = (end_u - u) / (block_end - i);
+        float v_step = (end_v - v) / (block_end - i);
+        float intensity_step = (end_intensity - intensity) / (block_end - i);
+        
+        for (; i < block_end; i++, u += u_step, v += v_step, intensity += intensity_step) {
+            if (span->depths != NULL) {
+                float depth = 1.0 - (span->reciprocal_w + span->reciprocal_w_step * i);
+                if (depth >= span->depths[i]) {
+                    continue;
+                }
+                span->depths[i] = depth;
+            }
+            uint32_t texel = bilinear ? bilinear_texel(span->texture, u, v) : wrapped_texel(span->texture, abs((int)u), abs((int)v));
+            if (span->shaded) {
+                texel = modulate_texel(texel, intensity_weight(intensity));
+            }
+            span->pixels[i] = texel;
+            pixels++;
+        }
+        u = end_u;
+        v = end_v;
+        intensity = end_intensity;
+    }
+    return pixels;
+}
+
+int draw_textured_span_subdivided(const textured_span_t* span, int count) {
+    return draw_subdivided_pixels(span, count, false);
+}
+
+int draw_bilinear_span_subdivided(const textured_span_t* span, int count) {
+    return draw_subdivided_pixels(span, count, true);
+}
+
+static int draw_flat_pixels(const flat_span_t* span, int first, int count) {
+    int pixels = 0;
+    for (int i = first; i < count; i++) {
+        float depth = 1.0 - (span->reciprocal_w + span->reciprocal_w_step * i);
+        if (depth < span->depths[i]) {
+            span->depths[i] = depth;
+            span->pixels[i] = span->color;
+            pixels++;
+        }
+    }
+    return pixels;
+}
+
+static int draw_flat_span_scalar(const flat_span_t* span, int count) {
+    return draw_flat_pixels(span, 0, count);
+}
+
+#ifdef SPAN_X86_KERNELS
+
+__attribute__((target("sse2")))
+static inline __m128i abs_epi32_sse2(__m128i a) {
+    __m128i sign = _mm_srai_epi32(a, 31);
+    return _mm_sub_epi32(_mm_xor_si128(a, sign), sign);
+}
+
+// Weights of intensity_weight for 4 pixels, max and min give 0 for NaN like the scalar version
+__attribute__((target("sse2")))
+static inline __m128i intensity_weights_sse2(const textured_span_t* span, __m128 offset, __m128 reciprocal_w) {
+    __m128 intensity = _mm_div_ps(_mm_add_ps(_mm_set1_ps(span->intensity_over_w), _mm_mul_ps(_mm_set1_ps(span->intensity_over_w_step), offset)), reciprocal_w);
+    __m128 weight = _mm_max_ps(_mm_mul_ps(intensity, _mm_set1_ps(256.0)), _mm_setzero_ps());
+    return _mm_cvttps_epi32(_mm_min_ps(weight, _mm_set1_ps(256.0)));
+}
+
+// modulate_texel for 4 texels, the channel pairs are multiplied in 16 bit lanes
+__attribute__((target("sse2")))
+static inline __m128i modulate_texels_sse2(__m128i texels, __m128i weight) {
+    const __m128i red_blue_mask = _mm_set1_epi32(0x00FF00FF);
+    const __m128i green_mask = _mm_set1_epi32(0x0000FF00);
+    const __m128i alpha_mask = _mm_set1_epi32(0xFF000000);
+    __m128i weights = _mm_or_si128(weight, _mm_slli_epi32(weight, 16));
+    __m128i red_blue = _mm_srli_epi16(_mm_mullo_epi16(_mm_and_si128(texels, red_blue_mask), weights), 8);
+    __m128i green = _mm_and_si128(_mm_mullo_epi16(_mm_srli_epi16(texels, 8), weights), green_mask);
+    return _mm_or_si128(_mm_and_si128(texels, alpha_mask), _mm_or_si128(red_blue, green));
+}
+
+// 4 pixels at a time. SSE2 has no gather or masked store, the texels are fetched one by one and
+// the rejected lanes are blended back from the buffers. The last pixels go through the scalar loop.
+__attribute__((target("sse2")))
+static inline int draw_textured_pixels_sse2(const textured_span_t* span, int count, bool bilinear) {
+    const __m128 lane = _mm_setr_ps(0, 1, 2, 3);
+    const __m128 one = _mm_set1_ps(1.0);
+    const __m128 all = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    __m128 width = _mm_set1_ps((float)span->texture->width);
+    __m128 height = _mm_set1_ps((float)span->texture->height);
+    int pixels = 0;
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 offset = _mm_add_ps(_mm_set1_ps((float)i), lane);
+        __m128 reciprocal_w = _mm_add_ps(_mm_set1_ps(span->reciprocal_w), _mm_mul_ps(_mm_set1_ps(span->reciprocal_w_step), offset));
+        __m128 mask = all;
+        __m128 depth = one;
+        __m128 old_depth = one;
+        if (span->depths != NULL) {
+            depth = _mm_sub_ps(one, reciprocal_w);
+            old_depth = _mm_loadu_ps(span->depths + i);
+            mask = _mm_cmpnge_ps(depth, old_depth);
+        }
+        int bits = _mm_movemask_ps(mask);
+        if (bits == 0) {
+            continue;
+        }
+        __m128 u = _mm_div_ps(_mm_add_ps(_mm_set1_ps(span->u_over_w), _mm_mul_ps(_mm_set1_ps(span->u_over_w_step), offset)), reciprocal_w);
+        __m128 v = _mm_div_ps(_mm_add_ps(_mm_set1_ps(span->v_over_w), _mm_mul_ps(_mm_set1_ps(span->v_over_w_step), offset)), reciprocal_w);
+        __m128i texels;
+        if (bilinear) {
+            float x[4], y[4];
+            _mm_storeu_ps(x, _mm_mul_ps(u, width));
+            _mm_storeu_ps(y, _mm_mul_ps(v, height));
+            texels = _mm_setr_epi32(
+                bilinear_texel(span->texture, x[0], y[0]),
+                bilinear_texel(span->texture, x[1], y[1]),
+                bilinear_texel(span->texture, x[2], y[2]),
+                bilinear_texel(span->texture, x[3], y[3])
+            );
+        } else {
+            int tex_x[4], tex_y[4];
+            _mm_storeu_si128((__m128i*)tex_x, abs_epi32_sse2(_mm_cvttps_epi32(_mm_mul_ps(u, width))));
+            _mm_storeu_si128((__m128i*)tex_y, abs_epi32_sse2(_mm_cvttps_epi32(_mm_mul_ps(v, height))));
+            texels = _mm_setr_epi32(
+                wrapped_texel(span->texture, tex_x[0], tex_y[0]),
+                wrapped_texel(span->texture, tex_x[1], tex_y[1]),
+                wrapped_texel(span->texture, tex_x[2], tex_y[2]),
+                wrapped_texel(span->texture, tex_x[3], tex_y[3])
+            );
+        }
+        if (span->shaded) {
+            texels = modulate_texels_sse2(texels, intensity_weights_sse2(span, offset, reciprocal_w));
+        }
+        __m128i keep = _mm_castps_si128(mask);
+        __m128i old_pixels = _mm_loadu_si128((__m128i*)(span->pixels + i));
+        _mm_storeu_si128((__m128i*)(span->pixels + i), _mm_or_si128(_mm_and_si128(keep, texels), _mm_andnot_si128(keep, old_pixels)));
+        if (span->depths != NULL) {
+            _mm_storeu_ps(span->depths + i, _mm_or_ps(_mm_and_ps(mask, depth), _mm_andnot_ps(mask, old_depth)));
+        }
+        pixels += __builtin_popcount(bits);
+    }
+    return pixels + draw_textured_pixels(span, i, count, bilinear);
+}
+
+__attribute__((target("sse2")))
+static int draw_textured_span_sse2(const textured_span_t* span, int count) {
+    return draw_textured_pixels_sse2(span, count, false);
+}
+
+__attribute__((target("sse2")))
+static int draw_bilinear_span_sse2(const textured_span_t* span, int count) {
+    return draw_textured_pixels_sse2(span, count, true);
+}
+
+__attribute__((target("sse2")))
+static int draw_flat_span_sse2(const flat_span_t* span, int count) {
+    const __m128 lane = _mm_setr_ps(0, 1, 2, 3);
+    const __m128 one = _mm_set1_ps(1.0);
+    __m128i color = _mm_set1_epi32((int)span->color);
+    int pixels = 0;
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 offset = _mm_add_ps(_mm_set1_ps((float)i), lane);
+        __m128 depth = _mm_sub_ps(one, _mm_add_ps(_mm_set1_ps(span->reciprocal_w), _mm_mul_ps(_mm_set1_ps(span->reciprocal_w_step), offset)));
+        __m128 old_depth = _mm_loadu_ps(span->depths + i);
+        __m128 mask = _mm_cmpnge_ps(depth, old_depth);
+        int bits = _mm_movemask_ps(mask);
+        if (bits == 0) {
+            continue;
+        }
+        __m128i keep = _mm_castps_si128(mask);
+        __m128i old_pixels = _mm_loadu_si128((__m128i*)(span->pixels + i));
+        _mm_storeu_si128((__m128i*)(span->pixels + i), _mm_or_si128(_mm_and_si128(keep, color), _mm_andnot_si128(keep, old_pixels)));
+        _mm_storeu_ps(span->depths + i, _mm_or_ps(_mm_and_ps(mask, depth), _mm_andnot_ps(mask, old_depth)));
+        pixels += __builtin_popcount(bits);
+    }
+    return pixels + draw_flat_pixels(span, i, count);
+}
+
+// Repeat texels of any sign on a texture that isn't a power of two. The remainder is taken in
+// floats, exact while the texel coordinates stay below 2^24, and clamped so a garbage lane can
+// never index outside the texture.
+__attribute__((target("avx2")))
+static inline __m256i wrap_texel_avx2(__m256i texel, __m256 size, __m256 reciprocal_size) {
+    __m256 a = _mm256_cvtepi32_ps(texel);
+    __m256 quotient = _mm256_cvtepi32_ps(_mm256_cvttps_epi32(_mm256_mul_ps(a, reciprocal_size)));
+    __m256 r = _mm256_sub_ps(a, _mm256_mul_ps(quotient, size));
+    r = _mm256_add_ps(r, _mm256_and_ps(_mm256_cmp_ps(r, _mm256_setzero_ps(), _CMP_LT_OQ), size));
+    r = _mm256_sub_ps(r, _mm256_and_ps(_mm256_cmp_ps(r, size, _CMP_GE_OQ), size));
+    r = _mm256_min_ps(_mm256_max_ps(r, _mm256_setzero_ps()), _mm256_sub_ps(size, _mm256_set1_ps(1.0)));
+    return _mm256_cvttps_epi32(r);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i morton_spread_avx2(__m256i a) {
+    a = _mm256_and_si256(_mm256_or_si256(a, _mm256_slli_epi32(a, 8)), _mm256_set1_epi32(0x00FF00FF));
+    a = _mm256_and_si256(_mm256_or_si256(a, _mm256_slli_epi32(a, 4)), _mm256_set1_epi32(0x0F0F0F0F));
+    a = _mm256_and_si256(_mm256_or_si256(a, _mm256_slli_epi32(a, 2)), _mm256_set1_epi32(0x33333333));
+    a = _mm256_and_si256(_mm256_or_si256(a, _mm256_slli_epi32(a, 1)), _mm256_set1_epi32(0x55555555));
+    return a;
+}
+
+// Morton index bits of 8 columns or rows, the same values as the swizzle_x and swizzle_y tables
+__attribute__((target("avx2")))
+static inline __m256i morton_column_avx2(__m256i x, __m256i square_mask, __m128i square_bits, __m128i double_square_bits) {
+    return _mm256_or_si256(morton_spread_avx2(_mm256_and_si256(x, square_mask)), _mm256_sll_epi32(_mm256_srl_epi32(x, square_bits), double_square_bits));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i morton_row_avx2(__m256i y, __m256i square_mask, __m128i square_bits, __m128i double_square_bits) {
+    return _mm256_or_si256(_mm256_slli_epi32(morton_spread_avx2(_mm256_and_si256(y, square_mask)), 1), _mm256_sll_epi32(_mm256_srl_epi32(y, square_bits), double_square_bits));
+}
+
+// lerp_texels for 8 texels. The bytes are widened to 16 bits, where a channel times a weight of
+// at most 256 still fits, with the weight of each pixel repeated over its 4 channels.
+__attribute__((target("avx2")))
+static inline __m256i lerp_texels_avx2(__m256i a, __m256i b, __m256i weight) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i full = _mm256_set1_epi16(256);
+    __m256i weights = _mm256_or_si256(weight, _mm256_slli_epi32(weight, 16));
+    __m256i weights_low = _mm256_unpacklo_epi32(weights, weights);
+    __m256i weights_high = _mm256_unpackhi_epi32(weights, weights);
+    __m256i low = _mm256_add_epi16(
+        _mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_sub_epi16(full, weights_low)),
+        _mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero), weights_low)
+    );
+    __m256i high = _mm256_add_epi16(
+        _mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_sub_epi16(full, weights_high)),
+        _mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero), weights_high)
+    );
+    return _mm256_packus_epi16(_mm256_srli_epi16(low, 8), _mm256_srli_epi16(high, 8));
+}
+
+// intensity_weights_sse2 and modulate_texels_sse2 for 8 pixels
+__attribute__((target("avx2")))
+static inline __m256i intensity_weights_avx2(const textured_span_t* span, __m256 offset, __m256 reciprocal_w) {
+    __m256 intensity = _mm256_div_ps(_mm256_add_ps(_mm256_set1_ps(span->intensity_over_w), _mm256_mul_ps(_mm256_set1_ps(span->intensity_over_w_step), offset)), reciprocal_w);
+    __m256 weight = _mm256_max_ps(_mm256_mul_ps(intensity, _mm256_set1_ps(256.0)), _mm256_setzero_ps());
+    return _mm256_cvttps_epi32(_mm256_min_ps(weight, _mm256_set1_ps(256.0)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i modulate_texels_avx2(__m256i texels, __m256i weight) {
+    const __m256i red_blue_mask = _mm256_set1_epi32(0x00FF00FF);
+    const __m256i green_mask = _mm256_set1_epi32(0x0000FF00);
+    const __m256i alpha_mask = _mm256_set1_epi32(0xFF000000);
+    __m256i weights = _mm256_or_si256(weight, _mm256_slli_epi32(weight, 16));
+    __m256i red_blue = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_and_si256(texels, red_blue_mask), weights), 8);
+    __m256i green = _mm256_and_si256(_mm256_mullo_epi16(_mm256_srli_epi16(texels, 8), weights), green_mask);
+    return _mm256_or_si256(_mm256_and_si256(texels, alpha_mask), _mm256_or_si256(red_blue, green));
+}
+
+// 8 pixels at a time. The lanes past the end of the span and the ones failing the depth test are
+// masked off the loads, the texel gather and the stores, so no pixel outside the span is touched.
+__attribute__((target("avx2")))
+static inline int draw_textured_pixels_avx2(const textured_span_t* span, int count, bool shaded) {
+    const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 one = _mm256_set1_ps(1.0);
+    const texture_level_t* texture = span->texture;
+    __m256 width = _mm256_set1_ps((float)texture->width);
+    __m256 height = _mm256_set1_ps((float)texture->height);
+    __m256 reciprocal_width = _mm256_set1_ps(1.0f / texture->width);
+    __m256 reciprocal_height = _mm256_set1_ps(1.0f / texture->height);
+    __m256i width_index = _mm256_set1_epi32(texture->width);
+    __m256i width_mask = _mm256_set1_epi32(texture->width_mask);
+    __m256i height_mask = _mm256_set1_epi32(texture->height_mask);
+    __m256i square_mask = _mm256_set1_epi32((1 << texture->square_bits) - 1);
+    __m128i square_bits = _mm_cvtsi32_si128(texture->square_bits);
+    __m128i double_square_bits = _mm_cvtsi32_si128(2 * texture->square_bits);
+    int pixels = 0;
+    for (int i = 0; i < count; i += 8) {
+        __m256i active = _mm256_cmpgt_epi32(_mm256_set1_epi32(count - i), lane_index);
+        __m256 offset = _mm256_add_ps(_mm256_set1_ps((float)i), lane);
+        __m256 reciprocal_w = _mm256_add_ps(_mm256_set1_ps(span->reciprocal_w), _mm256_mul_ps(_mm256_set1_ps(span->reciprocal_w_step), offset));
+        __m256 mask = _mm256_castsi256_ps(active);
+        __m256 depth = _mm256_sub_ps(one, reciprocal_w);
+        if (span->depths != NULL) {
+            __m256 old_depth = _mm256_maskload_ps(span->depths + i, active);
+            mask = _mm256_and_ps(mask, _mm256_cmp_ps(depth, old_depth, _CMP_NGE_UQ));
+        }
+        int bits = _mm256_movemask_ps(mask);
+        if (bits == 0) {
+            continue;
+        }
+        __m256 u = _mm256_div_ps(_mm256_add_ps(_mm256_set1_ps(span->u_over_w), _mm256_mul_ps(_mm256_set1_ps(span->u_over_w_step), offset)), reciprocal_w);
+        __m256 v = _mm256_div_ps(_mm256_add_ps(_mm256_set1_ps(span->v_over_w), _mm256_mul_ps(_mm256_set1_ps(span->v_over_w_step), offset)), reciprocal_w);
+        __m256i tex_x = _mm256_abs_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(u, width)));
+        __m256i tex_y = _mm256_abs_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(v, height)));
+        __m256i index;
+        if (texture->swizzled) {
+            index = _mm256_or_si256(
+                morton_column_avx2(_mm256_and_si256(tex_x, width_mask), square_mask, square_bits, double_square_bits),
+                morton_row_avx2(_mm256_and_si256(tex_y, height_mask), square_mask, square_bits, double_square_bits)
+            );
+        } else {
+            tex_x = wrap_texel_avx2(tex_x, width, reciprocal_width);
+            tex_y = wrap_texel_avx2(tex_y, height, reciprocal_height);
+            index = _mm256_add_epi32(_mm256_mullo_epi32(tex_y, width_index), tex_x);
+        }
+        __m256i keep = _mm256_castps_si256(mask);
+        __m256i texels = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)texture->texels, index, keep, 4);
+        if (shaded) {
+            texels = modulate_texels_avx2(texels, intensity_weights_avx2(span, offset, reciprocal_w));
+        }
+        _mm256_maskstore_epi32((int*)(span->pixels + i), keep, texels);
+        if (span->depths != NULL) {
+            _mm256_maskstore_ps(span->depths + i, keep, depth);
+        }
+        pixels += __builtin_popcount(bits);
+    }
+    return pixels;
+}
+
+// The bilinear version of draw_textured_span_avx2, with 4 gathers for the texels around each pixel
+__attribute__((target("avx2")))
+static inline int draw_bilinear_pixels_avx2(const textured_span_t* span, int count, bool shaded) {
+    const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 one = _mm256_set1_ps(1.0);
+    const __m256 half = _mm256_set1_ps(0.5);
+    const __m256 weight_scale = _mm256_set1_ps(256.0);
+    const __m256i next = _mm256_set1_epi32(1);
+    const texture_level_t* texture = span->texture;
+    __m256 width = _mm256_set1_ps((float)texture->width);
+    __m256 height = _mm256_set1_ps((float)texture->height);
+    __m256 reciprocal_width = _mm256_set1_ps(1.0f / texture->width);
+    __m256 reciprocal_height = _mm256_set1_ps(1.0f / texture->height);
+    __m256i width_index = _mm256_set1_epi32(texture->width);
+    __m256i width_mask = _mm256_set1_epi32(texture->width_mask);
+    __m256i height_mask = _mm256_set1_epi32(texture->height_mask);
+    __m256i square_mask = _mm256_set1_epi32((1 << texture->square_bits) - 1);
+    __m128i square_bits = _mm_cvtsi32_si128(texture->square_bits);
+    __m128i double_square_bits = _mm_cvtsi32_si128(2 * texture->square_bits);
+    const int* texels = (const int*)texture->texels;
+    int pixels = 0;
+    for (int i = 0; i < count; i += 8) {
+        __m256i active = _mm256_cmpgt_epi32(_mm256_set1_epi32(count - i), lane_index);
+        __m256 offset = _mm256_add_ps(_mm256_set1_ps((float)i), lane);
+        __m256 reciprocal_w = _mm256_add_ps(_mm256_set1_ps(span->reciprocal_w), _mm256_mul_ps(_mm256_set1_ps(span->reciprocal_w_step), offset));
+        __m256 mask = _mm256_castsi256_ps(active);
+        __m256 depth = _mm256_sub_ps(one, reciprocal_w);
+        if (span->depths != NULL) {
+            __m256 old_depth = _mm256_maskload_ps(span->depths + i, active);
+            mask = _mm256_and_ps(mask, _mm256_cmp_ps(depth, old_depth, _CMP_NGE_UQ));
+        }
+        int bits = _mm256_movemask_ps(mask);
+        if (bits == 0) {
+            continue;
+        }
+        __m256 u = _mm256_div_ps(_mm256_add_ps(_mm256_set1_ps(span->u_over_w), _mm256_mul_ps(_mm256_set1_ps(span->u_over_w_step), offset)), reciprocal_w);
+        __m256 v = _mm256_div_ps(_mm256_add_ps(_mm256_set1_ps(span->v_over_w), _mm256_mul_ps(_mm256_set1_ps(span->v_over_w_step), offset)), reciprocal_w);
+        
+        // Top left texel and the weights of the ones to its right and below, as in bilinear_texel
+        __m256 x = _mm256_sub_ps(_mm256_mul_ps(u, width), half);
+        __m256 y = _mm256_sub_ps(_mm256_mul_ps(v, height), half);
+        __m256 x_floor = _mm256_floor_ps(x);
+        __m256 y_floor = _mm256_floor_ps(y);
+        __m256i x_weight = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(x, x_floor), weight_scale));
+        __m256i y_weight = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(y, y_floor), weight_scale));
+        __m256i x0 = _mm256_cvttps_epi32(x_floor);
+        __m256i y0 = _mm256_cvttps_epi32(y_floor);
+        __m256i x1 = _mm256_add_epi32(x0, next);
+        __m256i y1 = _mm256_add_epi32(y0, next);
+        __m256i column0, column1, row0, row1;
+        if (texture->swizzled) {
+            column0 = morton_column_avx2(_mm256_and_si256(x0, width_mask), square_mask, square_bits, double_square_bits);
+            column1 = morton_column_avx2(_mm256_and_si256(x1, width_mask), square_mask, square_bits, double_square_bits);
+            row0 = morton_row_avx2(_mm256_and_si256(y0, height_mask), square_mask, square_bits, double_square_bits);
+            row1 = morton_row_avx2(_mm256_and_si256(y1, height_mask), square_mask, square_bits, double_square_bits);
+        } else {
+            column0 = wrap_texel_avx2(x0, width, reciprocal_width);
+            column1 = wrap_texel_avx2(x1, width, reciprocal_width);
+            row0 = _mm256_mullo_epi32(wrap_texel_avx2(y0, height, reciprocal_height), width_index);
+            row1 = _mm256_mullo_epi32(wrap_texel_avx2(y1, height, reciprocal_height), width_index);
+        }
+        // Morton bits of a column and a row never overlap, so OR and ADD give the same index
+        __m256i keep = _mm256_castps_si256(mask);
+        __m256i zero = _mm256_setzero_si256();
+        __m256i top_left = _mm256_mask_i32gather_epi32(zero, texels, _mm256_add_epi32(row0, column0), keep, 4);
+        __m256i top_right = _mm256_mask_i32gather_epi32(zero, texels, _mm256_add_epi32(row0, column1), keep, 4);
+        __m256i bottom_left = _mm256_mask_i32gather_epi32(zero, texels, _mm256_add_epi32(row1, column0), keep, 4);
+        __m256i bottom_right = _mm256_mask_i32gather_epi32(zero, texels, _mm256_add_epi32(row1, column1), keep, 4);
+        __m256i result = lerp_texels_avx2(
+            lerp_texels_avx2(top_left, top_right, x_weight),
+            lerp_texels_avx2(bottom_left, bottom_right, x_weight),
+            y_weight
+        );
+        if (shaded) {
+            result = modulate_texels_avx2(result, intensity_weights_avx2(span, offset, reciprocal_w));
+        }
+        _mm256_maskstore_epi32((int*)(span->pixels + i), keep, result);
+        if (span->depths != NULL) {
+            _mm256_maskstore_ps(span->depths + i, keep, depth);
+        }
+        pixels += __builtin_popcount(bits);
+    }
+    return pixels;
+}
+
+// The kernels are compiled twice, so the unshaded loops carry no trace of the lighting
+__attribute__((target("avx2")))
+static int draw_textured_span_avx2(const textured_span_t* span, int count) {
+    return span->shaded ? draw_textured_pixels_avx2(span, count, true) : draw_textured_pixels_avx2(span, count, false);
+}
+
+__attribute__((target("avx2")))
+static int draw_bilinear_span_avx2(const textured_span_t* span, int count) {
+    return span->shaded ? draw_bilinear_pixels_avx2(span, count, true) : draw_bilinear_pixels_avx2(span, count, false);
+}
+
+__attribute__((target("avx2")))
+static int draw_flat_span_avx2(const flat_span_t* span, int count) {
+    const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 one = _mm256_set1_ps(1.0);
+    __m256i color = _mm256_set1_epi32((int)span->color);
+    int pixels = 0;
+    for (int i = 0; i < count; i += 8) {
+        __m256i active = _mm256_cmpgt_epi32(_mm256_set1_epi32(count - i), lane_index);
+        __m256 offset = _mm256_add_ps(_mm256_set1_ps((float)i), lane);
+        __m256 depth = _mm256_sub_ps(one, _mm256_add_ps(_mm256_set1_ps(span->reciprocal_w), _mm256_mul_ps(_mm256_set1_ps(span->reciprocal_w_step), offset)));
+        __m256 old_depth = _mm256_maskload_ps(span->depths + i, active);
+        __m256 mask = _mm256_and_ps(_mm256_castsi256_ps(active), _mm256_cmp_ps(depth, old_depth, _CMP_NGE_UQ));
+        int bits = _mm256_movemask_ps(mask);
+        if (bits == 0) {
+            continue;
+        }
+        __m256i keep = _mm256_castps_si256(mask);
+        _mm256_maskstore_epi32((int*)(span->pixels + i), keep, color);
+        _mm256_maskstore_ps(span->depths + i, keep, depth);
+        pixels += __builtin_popcount(bits);
+    }
+    return pixels;
+}
+
+#endif
+
+textured_span_function_t draw_textured_span_kernel = draw_textured_span_scalar;
+textured_span_function_t draw_bilinear_span_kernel = draw_bilinear_span_scalar;
+flat_span_function_t draw_flat_span_kernel = draw_flat_span_scalar;
+const char* span_kernel_name = "scalar";
+
+void init_span_kernels(void) {
+#ifdef SPAN_X86_KERNELS
+    if (SDL_HasAVX2()) {
+        draw_textured_span_kernel = draw_textured_span_avx2;
+        draw_bilinear_span_kernel = draw_bilinear_span_avx2;
+        draw_flat_span_kernel = draw_flat_span_avx2;
+        span_kernel_name = "AVX2";
+        return;
+    }
+    if (SDL_HasSSE2()) {
+        draw_textured_span_kernel = draw_textured_span_sse2;
+        draw_bilinear_span_kernel = draw_bilinear_span_sse2;
+        draw_flat_span_kernel = draw_flat_span_sse2;
+        span_kernel_name = "SSE2";
+        return;
+    }
+#endif
+    draw_textured_span_kernel = draw_textured_span_scalar;
+    draw_bilinear_span_kernel = draw_bilinear_span_scalar;
+    draw_flat_span_kernel = draw_flat_span_scalar;
+    span_kernel_name = "scalar";
+}
@@ -0,0 +1,51 @@
+#ifndef SPAN_H
+#define SPAN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "texture.h"
+
+// Pixels between two exact perspective divides in the subdivided texturing mode
+#define SUBDIVIDE_SPAN 16
+// Triangles whose farthest vertex is more than this many times the distance of the closest one
+// are textured with the divide per pixel, the affine error between divides would show
+#define SUBDIVIDE_MAX_W_RATIO 2.0
+
+// One run of textured pixels on a row. The attributes are the values at the first pixel and their
+// steps per pixel, pixel i of the run uses value + step * i.
+typedef struct {
+    uint32_t* pixels;         // color buffer at the first pixel
+    float* depths;            // z-buffer at the first pixel, NULL draws without depth test
+    int x;                    // screen column of the first pixel
+    const texture_level_t* texture;
+    float u_over_w, v_over_w, reciprocal_w;
+    float u_over_w_step, v_over_w_step, reciprocal_w_step;
+    bool shaded;              // scale the texels by the interpolated light intensity
+    float intensity_over_w, intensity_over_w_step;
+} textured_span_t;
+
+// Run of flat colored pixels tested against the z-buffer
+typedef struct {
+    uint32_t* pixels;
+    float* depths;
+    uint32_t color;
+    float reciprocal_w, reciprocal_w_step;
+} flat_span_t;
+
+// Draw count pixels of a span and return how many were written
+typedef int (*textured_span_function_t)(const textured_span_t* span, int count);
+typedef int (*flat_span_function_t)(const flat_span_t* span, int count);
+
+extern textured_span_function_t draw_textured_span_kernel;
+extern textured_span_function_t draw_bilinear_span_kernel;
+extern flat_span_function_t draw_flat_span_kernel;
+extern const char* span_kernel_name;
+
+// Perspective divide only on multiples of SUBDIVIDE_SPAN in screen x, affine in between
+int draw_textured_span_subdivided(const textured_span_t* span, int count);
+int draw_bilinear_span_subdivided(const textured_span_t* span, int count);
+
+// Pick the widest kernel the CPU supports
+void init_span_kernels(void);
+
+#endif
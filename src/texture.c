@@ -1,25 +1,154 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 #include "texture.h"
 
+texture_t mesh_texture = { .num_levels = 0 };
 
+// Sample the smaller mip levels of textures that cover few pixels on the screen
+bool mipmapping = true;
 
-int texture_width = 64;
-int texture_height = 64;
+static bool is_power_of_two(int value) {
+    return value > 0 && (value & (value - 1)) == 0;
+}
 
-upng_t* png_texture = NULL;
+static int log2_int(int value) {
+    int bits = 0;
+    while ((1 << bits) < value) {
+        bits++;
+    }
+    return bits;
+}
 
-uint32_t* mesh_texture = NULL;
+static void free_texture_level(texture_level_t* level) {
+    free(level->texels);
+    free(level->swizzle_x);
+    free(level->swizzle_y);
+    level->texels = NULL;
+    level->swizzle_x = NULL;
+    level->swizzle_y = NULL;
+}
 
-void load_png_texture_data(char* filename) {
-    png_texture = upng_new_from_file(filename);
-    if (png_texture != NULL) {
-        upng_decode(png_texture);
-        if (upng_get_error(png_texture) == UPNG_EOK) {
-            mesh_texture = (uint32_t*)upng_get_buffer(png_texture);
-            texture_width = upng_get_width(png_texture);
-            texture_height = upng_get_height(png_texture);
+// Copy rows of texels into a level, reordering them to Morton order when the sizes allow
+static bool create_texture_level(texture_level_t* level, const uint32_t* rows, int width, int height) {
+    level->width = width;
+    level->height = height;
+    level->swizzled = is_power_of_two(width) && is_power_of_two(height);
+    level->width_mask = level->swizzled ? width - 1 : 0;
+    level->height_mask = level->swizzled ? height - 1 : 0;
+    level->square_bits = log2_int(width < height ? width : height);
+    level->texels = (uint32_t*) malloc(sizeof(uint32_t) * width * height);
+    level->swizzle_x = NULL;
+    level->swizzle_y = NULL;
+    if (level->swizzled) {
+        // The column and row bits of the Morton index never overlap
+        level->swizzle_x = (uint32_t*) malloc(sizeof(uint32_t) * width);
+        level->swizzle_y = (uint32_t*) malloc(sizeof(uint32_t) * height);
+        if (!level->swizzle_x || !level->swizzle_y) {
+            free_texture_level(level);
+            return false;
         }
+        for (int x = 0; x < width; x++) {
+            level->swizzle_x[x] = morton_index(level, x, 0);
+        }
+        for (int y = 0; y < height; y++) {
+            level->swizzle_y[y] = morton_index(level, 0, y);
+        }
+    }
+    if (!level->texels) {
+        free_texture_level(level);
+        return false;
+    }
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint32_t index = level->swizzled ? (level->swizzle_x[x] | level->swizzle_y[y]) : (uint32_t)(width * y + x);
+            level->texels[index] = rows[(width * y) + x];
+        }
+    }
+    return true;
+}
+
+// Average 2x2 blocks of a level into rows of half its size rounded up, each byte channel on its
+// own. The last row or column of an odd size is repeated, so its texels are kept.
+static void box_filter_level(const texture_level_t* level, uint32_t* rows, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        int y0 = 2 * y;
+        int y1 = (2 * y + 1 < level->height) ? 2 * y + 1 : y0;
+        for (int x = 0; x < width; x++) {
+            int x0 = 2 * x;
+            int x1 = (2 * x + 1 < level->width) ? 2 * x + 1 : x0;
+            uint32_t a = texture_texel(level, x0, y0);
+            uint32_t b = texture_texel(level, x1, y0);
+            uint32_t c = texture_texel(level, x0, y1);
+            uint32_t d = texture_texel(level, x1, y1);
+            uint32_t texel = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                uint32_t sum = ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF) + ((c >> shift) & 0xFF) + ((d >> shift) & 0xFF);
+                texel |= ((sum + 2) / 4) << shift;
+            }
+            rows[(width * y) + x] = texel;
+        }
+    }
+}
+
+// Create level 0 from the decoded image and halve it down to 1x1
+static bool create_texture(texture_t* texture, const uint32_t* rows, int width, int height) {
+    texture->num_levels = 0;
+    if (!create_texture_level(&texture->levels[0], rows, width, height)) {
+        return false;
+    }
+    texture->num_levels = 1;
+    uint32_t* half_rows = (uint32_t*) malloc(sizeof(uint32_t) * ((width + 1) / 2) * ((height + 1) / 2));
+    if (!half_rows) {
+        return true;
+    }
+    while (texture->num_levels < MAX_MIP_LEVELS && (width > 1 || height > 1)) {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        box_filter_level(&texture->levels[texture->num_levels - 1], half_rows, width, height);
+        if (!create_texture_level(&texture->levels[texture->num_levels], half_rows, width, height)) {
+            break;
+        }
+        texture->num_levels++;
+    }
+    free(half_rows);
+    return true;
+}
+
+// Mip level for a triangle covering texels_per_pixel texels of level 0 along a screen pixel
+int select_mip_level(const texture_t* texture, float texels_per_pixel) {
+    if (!mipmapping || !(texels_per_pixel > 1.0)) {
+        return 0;
+    }
+    // Nearest level, level n holds 2^n texels of level 0 per texel
+    int level = (int)floorf(log2f(texels_per_pixel) + 0.5);
+    return (level < texture->num_levels - 1) ? level : texture->num_levels - 1;
+}
+
+bool load_png_texture_data(char* filename) {
+    upng_t* png_texture = upng_new_from_file(filename);
+    if (png_texture == NULL) {
+        return false;
+    }
+    bool loaded = false;
+    upng_decode(png_texture);
+    if (upng_get_error(png_texture) == UPNG_EOK) {
+        loaded = create_texture(
+            &mesh_texture,
+            (const uint32_t*)upng_get_buffer(png_texture),
+            upng_get_width(png_texture),
+            upng_get_height(png_texture)
+        );
+    }
+    upng_free(png_texture);
+    return loaded;
+}
+
+void free_png_texture_data(void) {
+    for (int i = 0; i < mesh_texture.num_levels; i++) {
+        free_texture_level(&mesh_texture.levels[i]);
     }
+    mesh_texture.num_levels = 0;
 }
 
 const uint8_t REDBRICK_TEXTURE[] = {
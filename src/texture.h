@@ -2,6 +2,7 @@
 #define TEXTURE_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "upng.h"
 
 typedef struct {
@@ -10,13 +11,63 @@ typedef struct {
 
 } tex2_t;
 
-extern int texture_width;
-extern int texture_height;
+// Enough levels for a 32768 pixel wide image
+#define MAX_MIP_LEVELS 16
+
+// Texels of one level of an image. Power of two sizes wrap with a mask and are stored in Morton
+// (Z-order) so texels that are close in any direction are close in memory, other sizes wrap
+// with a modulo and stay in rows.
+typedef struct {
+    uint32_t* texels;
+    int width;
+    int height;
+    int width_mask;     // width - 1 when swizzled
+    int height_mask;    // height - 1 when swizzled
+    int square_bits;    // log2 of the smaller size, the bits interleaved in the Morton index
+    uint32_t* swizzle_x; // Morton index bits of every column, ORed with the ones of the row
+    uint32_t* swizzle_y;
+    bool swizzled;
+} texture_level_t;
+
+// A loaded image and its mip chain, every level box filtered down to half the previous one
+typedef struct {
+    texture_level_t levels[MAX_MIP_LEVELS];
+    int num_levels;
+} texture_t;
 
 //extern const uint8_t REDBRICK_TEXTURE[];
-extern upng_t* png_texture;
-extern uint32_t* mesh_texture;
+extern bool mipmapping;
+extern texture_t mesh_texture;
+
+// Spread the low 16 bits of a coordinate to the even bits
+static inline uint32_t morton_spread(uint32_t a) {
+    a = (a | (a << 8)) & 0x00FF00FF;
+    a = (a | (a << 4)) & 0x0F0F0F0F;
+    a = (a | (a << 2)) & 0x33333333;
+    a = (a | (a << 1)) & 0x55555555;
+    return a;
+}
+
+// Position of texel (x, y) in a swizzled texture. The square of the smaller size is interleaved,
+// a non square texture is a row or column of those squares.
+static inline uint32_t morton_index(const texture_level_t* texture, uint32_t x, uint32_t y) {
+    uint32_t square_mask = (1u << texture->square_bits) - 1;
+    return morton_spread(x & square_mask) | (morton_spread(y & square_mask) << 1) |
+        (((x | y) >> texture->square_bits) << (2 * texture->square_bits));
+}
+
+// Texel (x, y) of a texture, the coordinates must already be wrapped to its size
+static inline uint32_t texture_texel(const texture_level_t* texture, int x, int y) {
+    if (texture->swizzled) {
+        return texture->texels[texture->swizzle_x[x] | texture->swizzle_y[y]];
+    }
+    return texture->texels[(texture->width * y) + x];
+}
+
+bool load_png_texture_data(char* filename);
+
+int select_mip_level(const texture_t* texture, float texels_per_pixel);
 
-void load_png_texture_data(char* filename);
+void free_png_texture_data(void);
 
 #endif
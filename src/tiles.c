@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <SDL2/SDL.h>
+#include "tiles.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Tile binned rasterization
+///////////////////////////////////////////////////////////////////////////////
+// Triangles are added to the bins of every tile their bounding box touches, in drawing order.
+// The tiles are then handed out to a pool of threads, each drawing whole tiles clipped to their
+// rectangle. No two threads write the same pixel, so the color buffer and z-buffer need no locks,
+// and every tile sees its triangles in the same order as a single threaded draw.
+///////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    uint32_t* triangles;
+    int count;
+    int capacity;
+} tile_bin_t;
+
+static tile_bin_t* bins = NULL;
+static int tiles_x = 0;
+static int tiles_y = 0;
+static int screen_width = 0;
+static int screen_height = 0;
+
+// Worker threads, the thread calling tiles_draw works on the tiles as well. Every worker waits on
+// its own start semaphore, so each one draws exactly once per tiles_draw and fills its own slot.
+static SDL_Thread** workers = NULL;
+static int num_workers = 0;
+static SDL_sem** work_ready = NULL;
+static int num_work_ready = 0;
+static SDL_sem* work_done = NULL;
+static SDL_atomic_t next_tile;
+static tile_draw_function_t current_draw = NULL;
+static uint64_t* worker_pixels = NULL; // pixels written by each thread during the last draw
+static bool workers_quit = false;
+
+// Take tiles until none are left, returns the number of pixels written
+static uint64_t draw_tiles(void) {
+    uint64_t pixels = 0;
+    int num_tiles = tiles_x * tiles_y;
+    for (;;) {
+        int tile = SDL_AtomicAdd(&next_tile, 1);
+        if (tile >= num_tiles) {
+            break;
+        }
+        tile_bin_t* bin = &bins[tile];
+        int x = (tile % tiles_x) * TILE_SIZE;
+        int y = (tile / tiles_x) * TILE_SIZE;
+        clip_rect_t clip = {
+            x, y,
+            (x + TILE_SIZE < screen_width) ? x + TILE_SIZE : screen_width,
+            (y + TILE_SIZE < screen_height) ? y + TILE_SIZE : screen_height,
+            0
+        };
+        for (int i = 0; i < bin->count; i++) {
+            current_draw(bin->triangles[i], &clip);
+        }
+        pixels += clip.pixels;
+    }
+    return pixels;
+}
+
+static int worker_main(void* data) {
+    int slot = (int)(intptr_t)data;
+    for (;;) {
+        SDL_SemWait(work_ready[slot]);
+        if (workers_quit) {
+            return 0;
+        }
+        worker_pixels[slot] = draw_tiles();
+        SDL_SemPost(work_done);
+    }
+}
+
+// Start the worker pool, num_threads <= 0 uses one thread per CPU core
+bool tiles_init(int num_threads) {
+    if (num_threads <= 0) {
+        num_threads = SDL_GetCPUCount();
+    }
+    num_workers = (num_threads > 1) ? num_threads - 1 : 0;
+    if (num_workers == 0) {
+        return true;
+    }
+
+    work_ready = (SDL_sem**) calloc(num_workers, sizeof(SDL_sem*));
+    num_work_ready = work_ready ? num_workers : 0;
+    work_done = SDL_CreateSemaphore(0);
+    workers = (SDL_Thread**) calloc(num_workers, sizeof(SDL_Thread*));
+    worker_pixels = (uint64_t*) calloc(num_workers, sizeof(uint64_t));
+    bool created = work_ready && work_done && workers && worker_pixels;
+    for (int i = 0; created && i < num_workers; i++) {
+        work_ready[i] = SDL_CreateSemaphore(0);
+        created = work_ready[i] != NULL;
+    }
+    if (!created) {
+        fprintf(stderr, "Error creating the render threads.\n");
+        num_workers = 0;
+        tiles_destroy();
+        return false;
+    }
+    workers_quit = false;
+    for (int i = 0; i < num_workers; i++) {
+        workers[i] = SDL_CreateThread(worker_main, "render", (void*)(intptr_t)i);
+        if (!workers[i]) {
+            fprintf(stderr, "Error creating a render thread: %s\n", SDL_GetError());
+            num_workers = i;
+            tiles_destroy();
+            return false;
+        }
+    }
+    return true;
+}
+
+// Threads drawing the tiles, counting the caller of tiles_draw
+int tiles_num_threads(void) {
+    return num_workers + 1;
+}
+
+// Empty the bins, making the grid match the screen size
+void tiles_begin_frame(int width, int height) {
+    int new_tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int new_tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    if (new_tiles_x != tiles_x || new_tiles_y != tiles_y) {
+        for (int i = 0; i < tiles_x * tiles_y; i++) {
+            free(bins[i].triangles);
+        }
+        free(bins);
+        tiles_x = new_tiles_x;
+        tiles_y = new_tiles_y;
+        bins = (tile_bin_t*) calloc(tiles_x * tiles_y, sizeof(tile_bin_t));
+    }
+    screen_width = width;
+    screen_height = height;
+    for (int i = 0; i < tiles_x * tiles_y; i++) {
+        bins[i].count = 0;
+    }
+}
+
+// Add a triangle to every tile overlapping its inclusive pixel bounds
+void tiles_bin_triangle(uint32_t triangle_index, int x_min, int y_min, int x_max, int y_max) {
+    if (x_min < 0) x_min = 0;
+    if (y_min < 0) y_min = 0;
+    if (x_max > screen_width - 1) x_max = screen_width - 1;
+    if (y_max > screen_height - 1) y_max = screen_height - 1;
+    if (x_min > x_max || y_min > y_max) {
+        return;
+    }
+    for (int tile_y = y_min / TILE_SIZE; tile_y <= y_max / TILE_SIZE; tile_y++) {
+        for (int tile_x = x_min / TILE_SIZE; tile_x <= x_max / TILE_SIZE; tile_x++) {
+            tile_bin_t* bin = &bins[tile_y * tiles_x + tile_x];
+            if (bin->count == bin->capacity) {
+                bin->capacity = (bin->capacity > 0) ? bin->capacity * 2 : 64;
+                bin->triangles = (uint32_t*) realloc(bin->triangles, sizeof(uint32_t) * bin->capacity);
+            }
+            bin->triangles[bin->count++] = triangle_index;
+        }
+    }
+}
+
+// Draw all the bins on the worker threads and the calling thread, returns the pixels written
+uint64_t tiles_draw(tile_draw_function_t draw) {
+    current_draw = draw;
+    SDL_AtomicSet(&next_tile, 0);
+    for (int i = 0; i < num_workers; i++) {
+        SDL_SemPost(work_ready[i]);
+    }
+    uint64_t pixels = draw_tiles();
+    for (int i = 0; i < num_workers; i++) {
+        SDL_SemWait(work_done);
+    }
+    for (int i = 0; i < num_workers; i++) {
+        pixels += worker_pixels[i];
+    }
+    return pixels;
+}
+
+void tiles_destroy(void) {
+    workers_quit = true;
+    for (int i = 0; i < num_workers; i++) {
+        SDL_SemPost(work_ready[i]);
+    }
+    for (int i = 0; i < num_workers; i++) {
+        SDL_WaitThread(workers[i], NULL);
+    }
+    num_workers = 0;
+    free(workers);
+    free(worker_pixels);
+    workers = NULL;
+    worker_pixels = NULL;
+    for (int i = 0; i < num_work_ready; i++) {
+        if (work_ready[i]) SDL_DestroySemaphore(work_ready[i]);
+    }
+    if (work_done) SDL_DestroySemaphore(work_done);
+    free(work_ready);
+    work_ready = NULL;
+    num_work_ready = 0;
+    work_done = NULL;
+
+    for (int i = 0; i < tiles_x * tiles_y; i++) {
+        free(bins[i].triangles);
+    }
+    free(bins);
+    bins = NULL;
+    tiles_x = 0;
+    tiles_y = 0;
+}
@@ -0,0 +1,23 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "display.h"
+
+// Width and height in pixels of the screen tiles triangles are binned into
+#define TILE_SIZE 64
+// Most threads --threads accepts
+#define MAX_RENDER_THREADS 256
+
+// Draws one binned triangle, limited to the clip rectangle of a tile
+typedef void (*tile_draw_function_t)(uint32_t triangle_index, clip_rect_t* clip);
+
+bool tiles_init(int num_threads);
+int tiles_num_threads(void);
+void tiles_begin_frame(int width, int height);
+void tiles_bin_triangle(uint32_t triangle_index, int x_min, int y_min, int x_max, int y_max);
+uint64_t tiles_draw(tile_draw_function_t draw);
+void tiles_destroy(void);
+
+#endif
@@ -0,0 +1,71 @@
+#include <string.h>
+#include "transform.h"
+
+void transform_init(transform_t* transform) {
+    transform->rotation = (vec3_t){ 0, 0, 0 };
+    transform->scale = (vec3_t){ 1.0, 1.0, 1.0 };
+    transform->translation = (vec3_t){ 0, 0, 0 };
+    transform->world_matrix = mat4_identity();
+    transform->view_projection = mat4_identity();
+    transform->world_view_projection = mat4_identity();
+    transform->dirty = true;
+    transform->wvp_dirty = true;
+}
+
+static bool vec3_equal(vec3_t a, vec3_t b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+void transform_set_rotation(transform_t* transform, vec3_t rotation) {
+    if (!vec3_equal(transform->rotation, rotation)) {
+        transform->rotation = rotation;
+        transform->dirty = true;
+    }
+}
+
+void transform_set_scale(transform_t* transform, vec3_t scale) {
+    if (!vec3_equal(transform->scale, scale)) {
+        transform->scale = scale;
+        transform->dirty = true;
+    }
+}
+
+void transform_set_translation(transform_t* transform, vec3_t translation) {
+    if (!vec3_equal(transform->translation, translation)) {
+        transform->translation = translation;
+        transform->dirty = true;
+    }
+}
+
+void transform_rotate(transform_t* transform, vec3_t angles) {
+    transform_set_rotation(transform, vec3_add(transform->rotation, angles));
+}
+
+// Return the world matrix, composing it only when the transform changed since the last call
+const mat4_t* transform_get_world_matrix(transform_t* transform) {
+    if (transform->dirty) {
+        // Create World Matrix combining scale, rotation and translation
+        // Order matters: 1. scale, 2. rotate, 3. translate [T]*[R]*[S]*v
+        mat4_t world_matrix = mat4_identity();
+        world_matrix = mat4_mul_mat4(mat4_make_scale(transform->scale.x, transform->scale.y, transform->scale.z), world_matrix);
+        world_matrix = mat4_mul_mat4(mat4_make_rotation_z(transform->rotation.z), world_matrix);
+        world_matrix = mat4_mul_mat4(mat4_make_rotation_y(transform->rotation.y), world_matrix);
+        world_matrix = mat4_mul_mat4(mat4_make_rotation_x(transform->rotation.x), world_matrix);
+        world_matrix = mat4_mul_mat4(mat4_make_translation(transform->translation.x, transform->translation.y, transform->translation.z), world_matrix);
+        transform->world_matrix = world_matrix;
+        transform->dirty = false;
+        transform->wvp_dirty = true;
+    }
+    return &transform->world_matrix;
+}
+
+// Return view_projection * world, rebuilt when the transform or the view-projection changed
+const mat4_t* transform_get_world_view_projection(transform_t* transform, const mat4_t* view_projection) {
+    const mat4_t* world_matrix = transform_get_world_matrix(transform);
+    if (transform->wvp_dirty || memcmp(&transform->view_projection, view_projection, sizeof(mat4_t)) != 0) {
+        transform->view_projection = *view_projection;
+        transform->world_view_projection = mat4_mul_mat4(*view_projection, *world_matrix);
+        transform->wvp_dirty = false;
+    }
+    return &transform->world_view_projection;
+}
@@ -0,0 +1,31 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <stdbool.h>
+#include "vector.h"
+#include "matrix.h"
+
+// Scale, rotation and translation of an object, with the composed matrices cached.
+// Change it through the setters so the cache knows when it has to be rebuilt.
+typedef struct {
+    vec3_t rotation; // rotation with x, y, and z values
+    vec3_t scale; // scale with x, y, z, values
+    vec3_t translation; // translation with x, y, z, values
+    mat4_t world_matrix; // [T]*[R]*[S], valid when not dirty
+    mat4_t view_projection; // the view-projection the cached world-view-projection was built with
+    mat4_t world_view_projection; // view_projection * world_matrix
+    bool dirty; // world_matrix needs to be rebuilt
+    bool wvp_dirty; // world_view_projection needs to be rebuilt
+} transform_t;
+
+void transform_init(transform_t* transform);
+
+void transform_set_rotation(transform_t* transform, vec3_t rotation);
+void transform_set_scale(transform_t* transform, vec3_t scale);
+void transform_set_translation(transform_t* transform, vec3_t translation);
+void transform_rotate(transform_t* transform, vec3_t angles);
+
+const mat4_t* transform_get_world_matrix(transform_t* transform);
+const mat4_t* transform_get_world_view_projection(transform_t* transform, const mat4_t* view_projection);
+
+#endif
@@ -1,124 +1,11 @@
-
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include "display.h"
-#include "swap.h"
+#include "span.h"
+#include "tiles.h"
 #include "triangle.h"
 
-
-
-// Draw a filled a triangle with a flat bottom
-///////////////////////////////////////////////////////////////////////////////
-//
-//        (x0,y0)
-//          / \
-//         /   \
-//        /     \
-//       /       \
-//      /         \
-//  (x1,y1)------(x2,y2)
-//
-
-void fill_flat_bottom_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color) {
-    // find the two slopes, two triangle legs
-    float inv_slope_1 = (float)(x1 - x0) / (y1 - y0);
-    float inv_slope_2 = (float)(x2 - x0) / (y2 - y0);
-    
-    // start x_start and x_end
-    float x_start = x0;
-    float x_end = x0;
-    
-    for (int y = y0; y <= y2; y++) {
-        draw_line( x_start, y, x_end, y, color);
-        x_start += inv_slope_1;
-        x_end += inv_slope_2;
-    }
-    
-
-}
-
-// Draw a filled a triangle with a flat top
-///////////////////////////////////////////////////////////////////////////////
-//
-//  (x0,y0)------(x1,y1)
-//      \         /
-//       \       /
-//        \     /
-//         \   /
-//          \ /
-//        (x2,y2)
-//
-
-void fill_flat_top_triangle( int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color ) {
-    // find the two slopes, two triangle legs
-    float inv_slope_1 = (float)(x2 - x0) / (y2 - y0);
-    float inv_slope_2 = (float)(x2 - x1) / (y2 - y1);
-    
-    // start x_start and x_end
-    float x_start = x2;
-    float x_end = x2;
-    
-    for (int y = y2; y >= y0; y--) {
-        draw_line( x_start, y, x_end, y, color);
-        x_start -= inv_slope_1;
-        x_end -= inv_slope_2;
-    }
-}
-
-//
-//          (x0,y0)
-//            / \
-//           /   \
-//          /     \
-//         /       \
-//        /         \
-//   (x1,y1)------(Mx,My)
-//       \_           \
-//          \_         \
-//             \_       \
-//                \_     \
-//                   \    \
-//                     \_  \
-//                        \_\
-//                           \
-//                         (x2,y2)
-
-void draw_filled_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color) {
-    
-    // We need to sort the vertices by y-coordinate ascending (yo < y1 < y2)
-
-    if (y0 > y1) {
-        int_swap(&y0, &y1);
-        int_swap(&x0, &x1);
-    }
-    if (y1 > y2) {
-        int_swap(&y1, &y2);
-        int_swap(&x1, &x2);
-    }
-    if (y0 > y1) {
-        int_swap(&y0, &y1);
-        int_swap(&x0, &x1);
-    }
-    
-    if (y1 == y2) {
-        fill_flat_bottom_triangle(x0, y0, x1, y1, x2, y2, color);
-    }
-    
-    else if (y0 == y1) {
-        fill_flat_top_triangle(x0, y0, x1, y1, x2, y2, color);
-    }
-    else {
-        // Calculate the new vertex (Mx, My) using triangle similarity
-        int My = y1;
-        int Mx = (((x2 - x0) * (y1 - y0)) / (y2 - y0)) + x0;
-        // TODO: draw flat-bottom triangle
-        fill_flat_bottom_triangle(x0, y0, x1, y1, Mx, My, color);
-        
-        // TODO: draw flat-top triangle
-        fill_flat_top_triangle(x1, y1, Mx, My, x2, y2, color );
-    }
-    
-    
-}
-
 // Draw a triangle using three raw line calls
 ///////////////////////////////////////////////////////////////////////////////
 void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color) {
@@ -127,6 +14,12 @@ void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t colo
     draw_line(x2, y2, x0, y0, color);
 }
 
+void draw_triangle_clipped(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color, clip_rect_t* clip) {
+    draw_line_clipped(x0, y0, x1, y1, color, clip);
+    draw_line_clipped(x1, y1, x2, y2, color, clip);
+    draw_line_clipped(x2, y2, x0, y0, color, clip);
+}
+
 // Return the barycentric weights alpha, beta, and gamma for point p
 ///////////////////////////////////////////////////////////////////////////////
 //
@@ -165,176 +58,450 @@ vec3_t barycentric_weights(vec2_t a, vec2_t b, vec2_t c, vec2_t p) {
 }
 
 
-// function that draws the textured pioxel at position x and y using interpolation
+///////////////////////////////////////////////////////////////////////////////
+// Fixed point rasterizer
+///////////////////////////////////////////////////////////////////////////////
+// Vertex positions are snapped to 28.4 fixed point (1/16 of a pixel) and pixels are sampled at
+// their centers. Coverage follows the top-left rule, so a pixel exactly on an edge shared by two
+// triangles belongs to only one of them. Each row is walked as one exact span [x_start, x_end).
+// Attributes are stepped along rows and spans but evaluated again from their planes at every tile
+// boundary, so a pixel gets the same value whether the triangle is drawn whole or tile by tile.
+///////////////////////////////////////////////////////////////////////////////
 
-void draw_texel (
-    int x, int y, uint32_t* texture,
-    vec4_t point_a, vec4_t point_b, vec4_t point_c,
-    tex2_t a_uv, tex2_t b_uv, tex2_t c_uv
-                 ) {
-    vec2_t p = { x, y };
-    vec2_t a = vec2_from_vec4(point_a);
-    vec2_t b = vec2_from_vec4(point_b);
-    vec2_t c = vec2_from_vec4(point_c);
-    
-    vec3_t weights = barycentric_weights( a, b, c, p);
-    float alpha = weights.x;
-    float beta = weights.y;
-    float gamma = weights.z;
-    
-    // variables to store interpolated values of u, v and 1/w
-    float interpolated_u;
-    float interpolated_v;
-    float interpolated_reciprocal_w;
-    
-    
-    // Perform the interpolation of all U/w and V/w values using barycentric weights
-    interpolated_u = (a_uv.u / point_a.w) * alpha + (b_uv.u / point_b.w) * beta + (c_uv.u / point_c.w) * gamma;
-    interpolated_v = (a_uv.v / point_a.w) * alpha + (b_uv.v / point_b.w) * beta + (c_uv.v / point_c.w) * gamma;
-    
-    // Also interpolate the value of 1/u for the current pixel
-    interpolated_reciprocal_w = (1 / point_a.w) * alpha + (1 / point_b.w) * beta + (1 / point_c.w) * gamma;
-    
-    // Now we can divide back both interpolated values by 1/u
-    interpolated_u /= interpolated_reciprocal_w;
-    interpolated_v /= interpolated_reciprocal_w;
-    
-    
-    // Map the uv coordinate to the full texture width and height
-    int tex_x = abs((int)(interpolated_u * texture_width)) % texture_width;
-    
-    int tex_y = abs((int)(interpolated_v * texture_height)) % texture_height;
-    
-    draw_pixel(x, y, texture[(texture_width * tex_y) + tex_x]);
-    
+#define SUBPIXEL_BITS 4
+#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+#define SUBPIXEL_HALF (SUBPIXEL_ONE / 2)
+
+// Triangle vertex as the rasterizer sees it, with the position in pixels
+typedef struct {
+    float x, y, z, w, u, v, intensity;
+} raster_vertex_t;
+
+// Edge from vertex a to vertex b, the inside of the triangle is where
+// dx * (py - ay) - dy * (px - ax) + bias >= 0
+typedef struct {
+    int64_t ax, ay;
+    int64_t dx, dy;
+    int64_t bias; // 0 on top and left edges, -1 elsewhere so their pixels are left out
+} raster_edge_t;
+
+typedef struct {
+    raster_edge_t edges[3];
+    int y_start; // first and last pixel row, already clipped to the screen
+    int y_end;
+} raster_triangle_t;
+
+static int64_t floor_div(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    return (a % b != 0 && a < 0) ? q - 1 : q;
 }
 
+static int64_t ceil_div(int64_t a, int64_t b) {
+    return -floor_div(-a, b);
+}
 
-//
-//             v0
-//            / \
-//           /   \
-//          /     \
-//         /       \
-//        /         \
-//     v1 ---------- \
-//       \_           \
-//          \_         \
-//             \_       \
-//                \_     \
-//                   \    \
-//                     \_  \
-//                        \_\
-//                           \
-//                            v2
+// Snap the vertices, wind them so the inside is positive for all edges and find the rows to draw.
+// Returns false when the triangle has no area or misses every row of the clip rectangle.
+static bool setup_raster_triangle(raster_triangle_t* raster, raster_vertex_t vertices[3], const clip_rect_t* clip) {
+    int64_t x[3], y[3];
+    for (int i = 0; i < 3; i++) {
+        x[i] = lrintf(vertices[i].x * SUBPIXEL_ONE);
+        y[i] = lrintf(vertices[i].y * SUBPIXEL_ONE);
+    }
+    int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (area == 0) {
+        return false;
+    }
+    if (area < 0) {
+        raster_vertex_t vertex = vertices[1];
+        vertices[1] = vertices[2];
+        vertices[2] = vertex;
+        int64_t t = x[1]; x[1] = x[2]; x[2] = t;
+        t = y[1]; y[1] = y[2]; y[2] = t;
+    }
+    for (int i = 0; i < 3; i++) {
+        // The attribute planes use the same snapped positions as the coverage
+        vertices[i].x = (float)x[i] / SUBPIXEL_ONE;
+        vertices[i].y = (float)y[i] / SUBPIXEL_ONE;
 
-void draw_textured_triangle(
-                            int x0, int y0, float z0, float w0, float u0, float v0,
-                            int x1, int y1, float z1, float w1, float u1, float v1,
-                            int x2, int y2, float z2, float w2, float u2, float v2,
-    uint32_t* texture
-                            ) {
-    
-    //all the pixels of the triangle to reader then based on the color
-    //that cones from the texture array
-    // we need to sort the vertices
-    if (y0 > y1) {
-        int_swap(&y0, &y1);
-        int_swap(&x0, &x1);
-        float_swap(&z0, &z1);
-        float_swap(&w0, &w1);
-        float_swap(&u0, &u1);
-        float_swap(&v0, &v1);
+        raster_edge_t* edge = &raster->edges[i];
+        int next = (i + 1) % 3;
+        edge->ax = x[i];
+        edge->ay = y[i];
+        edge->dx = x[next] - x[i];
+        edge->dy = y[next] - y[i];
+        // With y pointing down, left edges go up and top edges go right
+        bool is_top_left = edge->dy < 0 || (edge->dy == 0 && edge->dx > 0);
+        edge->bias = is_top_left ? 0 : -1;
     }
-    if (y1 > y2) {
-        int_swap(&y1, &y2);
-        int_swap(&x1, &x2);
-        float_swap(&z1, &z2);
-        float_swap(&w1, &w2);
-        float_swap(&u1, &u2);
-        float_swap(&v1, &v2);
+
+    // Rows whose pixel centers lie between the lowest and highest vertex
+    int64_t y_min = y[0] < y[1] ? (y[0] < y[2] ? y[0] : y[2]) : (y[1] < y[2] ? y[1] : y[2]);
+    int64_t y_max = y[0] > y[1] ? (y[0] > y[2] ? y[0] : y[2]) : (y[1] > y[2] ? y[1] : y[2]);
+    int64_t y_start = ceil_div(y_min - SUBPIXEL_HALF, SUBPIXEL_ONE);
+    int64_t y_end = floor_div(y_max - SUBPIXEL_HALF, SUBPIXEL_ONE);
+    raster->y_start = y_start < clip->y_min ? clip->y_min : (int)y_start;
+    raster->y_end = y_end > clip->y_max - 1 ? clip->y_max - 1 : (int)y_end;
+    return raster->y_start <= raster->y_end;
+}
+
+// Pixels of row y covered by the triangle, clipped to the rectangle. Each edge limits the row to
+// one side of the column where it crosses the pixel centers.
+static bool raster_row_span(const raster_triangle_t* raster, int y, const clip_rect_t* clip, int* x_start, int* x_end) {
+    int64_t left = clip->x_min;
+    int64_t right = clip->x_max - 1;
+    int64_t py = (int64_t)y * SUBPIXEL_ONE + SUBPIXEL_HALF;
+    for (int i = 0; i < 3; i++) {
+        const raster_edge_t* edge = &raster->edges[i];
+        // dy * px <= k is the inside, with px = x * SUBPIXEL_ONE + SUBPIXEL_HALF
+        int64_t k = edge->dx * (py - edge->ay) + edge->dy * edge->ax + edge->bias - edge->dy * SUBPIXEL_HALF;
+        int64_t step = edge->dy * SUBPIXEL_ONE;
+        if (edge->dy > 0) {
+            int64_t limit = floor_div(k, step);
+            if (limit < right) right = limit;
+        } else if (edge->dy < 0) {
+            int64_t limit = ceil_div(-k, -step);
+            if (limit > left) left = limit;
+        } else if (k < 0) {
+            return false;
+        }
     }
-    if (y0 > y1) {
-        int_swap(&y0, &y1);
-        int_swap(&x0, &x1);
-        float_swap(&z0, &z1);
-        float_swap(&w0, &w1);
-        float_swap(&u0, &u1);
-        float_swap(&v0, &v1);
+    if (left > right) {
+        return false;
+    }
+    *x_start = (int)left;
+    *x_end = (int)right + 1;
+    return true;
+}
+
+// Screen space plane of an attribute that is linear across the triangle: value = origin + dx * x + dy * y,
+// with the origin at the center of pixel (0, 0)
+typedef struct {
+    float origin;
+    float dx;
+    float dy;
+} attribute_plane_t;
+
+// Edge function terms shared by all the attribute planes of a triangle
+typedef struct {
+    float x0;
+    float y0;
+    float ab_x, ab_y; // edge vectors from vertex 0
+    float ac_x, ac_y;
+    float inv_area; // 1 over the signed area of the parallelogram ABC
+} triangle_setup_t;
+
+// Per-triangle setup from the snapped vertices, the raster setup already rejected empty triangles
+static void setup_triangle(triangle_setup_t* setup, const raster_vertex_t vertices[3]) {
+    setup->x0 = vertices[0].x;
+    setup->y0 = vertices[0].y;
+    setup->ab_x = vertices[1].x - vertices[0].x;
+    setup->ab_y = vertices[1].y - vertices[0].y;
+    setup->ac_x = vertices[2].x - vertices[0].x;
+    setup->ac_y = vertices[2].y - vertices[0].y;
+    setup->inv_area = 1.0 / (setup->ab_x * setup->ac_y - setup->ac_x * setup->ab_y);
+}
+
+// Plane through the attribute values a0, a1, a2 at the three vertices
+static attribute_plane_t make_attribute_plane(const triangle_setup_t* setup, float a0, float a1, float a2) {
+    float d1 = a1 - a0;
+    float d2 = a2 - a0;
+    attribute_plane_t plane;
+    plane.dx = (d1 * setup->ac_y - d2 * setup->ab_y) * setup->inv_area;
+    plane.dy = (d2 * setup->ab_x - d1 * setup->ac_x) * setup->inv_area;
+    plane.origin = a0 + plane.dx * (0.5 - setup->x0) + plane.dy * (0.5 - setup->y0);
+    return plane;
+}
+
+// Fill a triangle with a flat color, testing every pixel against the z-buffer unless drawing
+// with the painter's algorithm
+void draw_filled_triangle(
+                          float x0, float y0, float z0, float w0,
+                          float x1, float y1, float z1, float w1,
+                          float x2, float y2, float z2, float w2,
+                          uint32_t color
+                          ) {
+    clip_rect_t clip = screen_clip_rect();
+    draw_filled_triangle_clipped(x0, y0, z0, w0, x1, y1, z1, w1, x2, y2, z2, w2, color, &clip);
+    frame_stats.pixels += clip.pixels;
+}
+
+void draw_filled_triangle_clipped(
+    float x0, float y0, float z0, float w0,
+    float x1, float y1, float z1, float w1,
+    float x2, float y2, float z2, float w2,
+    uint32_t color, clip_rect_t* clip
+) {
+    raster_vertex_t vertices[3] = {
+        { x0, y0, z0, w0, 0, 0, 0 },
+        { x1, y1, z1, w1, 0, 0, 0 },
+        { x2, y2, z2, w2, 0, 0, 0 }
+    };
+    raster_triangle_t raster;
+    if (!setup_raster_triangle(&raster, vertices, clip)) {
+        return;
     }
     
-    
-    // Flip the U component to account for inverted UV-coordinates (V - grows downwards)
-    v0 = 1.0 - v0;
-    v1 = 1.0 - v1;
-    v2 = 1.0 - v2;
-    
-    // Create vector points after we sort the vertices
-    vec4_t point_a = { x0, y0, z0, w0 };
-    vec4_t point_b = { x1, y1, z1, w1 };
-    vec4_t point_c = { x2, y2, z2, w2 };
-    tex2_t a_uv = { u0, v0 };
-    tex2_t b_uv = { u1, v1 };
-    tex2_t c_uv = { u2, v2 };
-    
-    // Render the upper part of the tiangle (flat bottom triangle)
-    ///////////////////////////////////
-    float inv_slope_1 = 0;
-    float inv_slope_2 = 0;
-    
-    if (y1 - y0 != 0) inv_slope_1 = (float)(x1 - x0) / abs(y1 - y0);
-    if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
-    
-    if (y1 - y0 != 0){
-        for (int y = y0; y <= y1; y++) {
-            int x_start = x1 + (y - y1) * inv_slope_1;
-            int x_end = x0 + (y - y0) * inv_slope_2;
-            
-            if (x_end < x_start) {
-                int_swap(&x_start, &x_end); // swap if x_start is to the right of x_end
-            }
-            
-            for (int x = x_start; x < x_end; x++) {
-                
-                // Draw our pixel with the color that comes from the texture
-                draw_texel(x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv );
+    if (depth_method == DEPTH_PAINTER) {
+        for (int y = raster.y_start; y <= raster.y_end; y++) {
+            int x_start, x_end;
+            if (raster_row_span(&raster, y, clip, &x_start, &x_end)) {
+                fill_pixels(&color_buffer[(window_width * y) + x_start], x_end - x_start, color);
+                clip->pixels += x_end - x_start;
             }
-            
         }
+        return;
     }
     
+    triangle_setup_t setup;
+    setup_triangle(&setup, vertices);
+    attribute_plane_t reciprocal_w = make_attribute_plane(&setup, 1 / vertices[0].w, 1 / vertices[1].w, 1 / vertices[2].w);
     
+    float row_reciprocal_w = 0;
+    for (int y = raster.y_start; y <= raster.y_end; y++, row_reciprocal_w += reciprocal_w.dy) {
+        if (y == raster.y_start || y % TILE_SIZE == 0) {
+            row_reciprocal_w = reciprocal_w.origin + reciprocal_w.dy * y;
+        }
+        int x_start, x_end;
+        if (!raster_row_span(&raster, y, clip, &x_start, &x_end)) {
+            continue;
+        }
+        for (int x = x_start; x < x_end; ) {
+            int segment_end = (x / TILE_SIZE + 1) * TILE_SIZE;
+            if (segment_end > x_end) {
+                segment_end = x_end;
+            }
+            flat_span_t span = {
+                &color_buffer[(window_width * y) + x],
+                &z_buffer[(window_width * y) + x],
+                color,
+                row_reciprocal_w + reciprocal_w.dx * x,
+                reciprocal_w.dx
+            };
+            clip->pixels += draw_flat_span_kernel(&span, segment_end - x);
+            x = segment_end;
+        }
+    }
+}
+
+// Planes of the perspective correct texture attributes of a triangle
+typedef struct {
+    attribute_plane_t u_over_w;
+    attribute_plane_t v_over_w;
+    attribute_plane_t reciprocal_w;
+    attribute_plane_t intensity_over_w; // only set up for shaded triangles
+} texture_planes_t;
+
+// Draw the textured pixels of row y from x_start to x_end (excluded). The row values are the
+// planes evaluated at x = 0, each tile segment of the row goes to the span kernel.
+static void draw_textured_span(
+    int y, int x_start, int x_end, float row_u, float row_v, float row_reciprocal_w, float row_intensity, bool shaded,
+    const texture_planes_t* planes, const texture_level_t* texture, textured_span_function_t kernel, clip_rect_t* clip
+) {
+    textured_span_t span = {
+        .texture = texture,
+        .u_over_w_step = planes->u_over_w.dx,
+        .v_over_w_step = planes->v_over_w.dx,
+        .reciprocal_w_step = planes->reciprocal_w.dx,
+        .shaded = shaded,
+        .intensity_over_w_step = planes->intensity_over_w.dx
+    };
+    for (int x = x_start; x < x_end; ) {
+        int segment_end = (x / TILE_SIZE + 1) * TILE_SIZE;
+        if (segment_end > x_end) {
+            segment_end = x_end;
+        }
+        span.x = x;
+        span.pixels = &color_buffer[(window_width * y) + x];
+        span.depths = (depth_method == DEPTH_PAINTER) ? NULL : &z_buffer[(window_width * y) + x];
+        span.u_over_w = row_u + planes->u_over_w.dx * x;
+        span.v_over_w = row_v + planes->v_over_w.dx * x;
+        span.reciprocal_w = row_reciprocal_w + planes->reciprocal_w.dx * x;
+        span.intensity_over_w = row_intensity + planes->intensity_over_w.dx * x;
+        clip->pixels += kernel(&span, segment_end - x);
+        x = segment_end;
+    }
+}
+
+// Level 0 texels a screen pixel steps over, from the screen space derivatives of u and v
+// (du/dx = (d(u/w)/dx - u * d(1/w)/dx) * w). Taken at the vertex where they are the smallest, so
+// the closest part of a triangle in perspective never gets blurry.
+static float texels_per_pixel(const texture_planes_t* planes, const raster_vertex_t vertices[3], const texture_level_t* texture) {
+    float smallest = INFINITY;
+    for (int i = 0; i < 3; i++) {
+        float w = vertices[i].w;
+        float du_dx = (planes->u_over_w.dx - vertices[i].u * planes->reciprocal_w.dx) * w * texture->width;
+        float dv_dx = (planes->v_over_w.dx - vertices[i].v * planes->reciprocal_w.dx) * w * texture->height;
+        float du_dy = (planes->u_over_w.dy - vertices[i].u * planes->reciprocal_w.dy) * w * texture->width;
+        float dv_dy = (planes->v_over_w.dy - vertices[i].v * planes->reciprocal_w.dy) * w * texture->height;
+        float footprint = fmaxf(du_dx * du_dx + dv_dx * dv_dx, du_dy * du_dy + dv_dy * dv_dy);
+        smallest = fminf(smallest, footprint);
+    }
+    return sqrtf(smallest);
+}
+
+// Draw a perspective correct textured triangle
+void draw_textured_triangle(
+                            float x0, float y0, float z0, float w0, float u0, float v0,
+                            float x1, float y1, float z1, float w1, float u1, float v1,
+                            float x2, float y2, float z2, float w2, float u2, float v2,
+    const float* intensities, const texture_t* texture
+                            ) {
+    clip_rect_t clip = screen_clip_rect();
+    draw_textured_triangle_clipped(x0, y0, z0, w0, u0, v0, x1, y1, z1, w1, u1, v1, x2, y2, z2, w2, u2, v2, intensities, texture, &clip);
+    frame_stats.pixels += clip.pixels;
+}
+
+void draw_textured_triangle_clipped(
+    float x0, float y0, float z0, float w0, float u0, float v0,
+    float x1, float y1, float z1, float w1, float u1, float v1,
+    float x2, float y2, float z2, float w2, float u2, float v2,
+    const float* intensities, const texture_t* texture, clip_rect_t* clip
+) {
+    // Flip the V component to account for inverted UV-coordinates (V - grows downwards)
+    bool shaded = (intensities != NULL);
+    raster_vertex_t vertices[3] = {
+        { x0, y0, z0, w0, u0, 1.0 - v0, shaded ? intensities[0] : 0 },
+        { x1, y1, z1, w1, u1, 1.0 - v1, shaded ? intensities[1] : 0 },
+        { x2, y2, z2, w2, u2, 1.0 - v2, shaded ? intensities[2] : 0 }
+    };
+    raster_triangle_t raster;
+    if (!setup_raster_triangle(&raster, vertices, clip)) {
+        return;
+    }
     
-    // Render the lower part of the tiangle (flat top triangle)
-    ///////////////////////////////////
-    inv_slope_1 = 0;
-    inv_slope_2 = 0;
+    // Triangle setup: the planes of u/w, v/w and 1/w are linear in screen space
+    triangle_setup_t setup;
+    setup_triangle(&setup, vertices);
+    texture_planes_t planes = {
+        .u_over_w = make_attribute_plane(&setup, vertices[0].u / vertices[0].w, vertices[1].u / vertices[1].w, vertices[2].u / vertices[2].w),
+        .v_over_w = make_attribute_plane(&setup, vertices[0].v / vertices[0].w, vertices[1].v / vertices[1].w, vertices[2].v / vertices[2].w),
+        .reciprocal_w = make_attribute_plane(&setup, 1 / vertices[0].w, 1 / vertices[1].w, 1 / vertices[2].w)
+    };
+    if (shaded) {
+        planes.intensity_over_w = make_attribute_plane(&setup, vertices[0].intensity / vertices[0].w, vertices[1].intensity / vertices[1].w, vertices[2].intensity / vertices[2].w);
+    }
     
-    if (y2 - y1 != 0) inv_slope_1 = (float)(x2 - x1) / abs(y2 - y1);
-    if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
+    // One mip level for the whole triangle
+    int level = 0;
+    if (mipmapping && texture->num_levels > 1) {
+        level = select_mip_level(texture, texels_per_pixel(&planes, vertices, &texture->levels[0]));
+    }
     
-    if (y2 - y1 != 0){
-        for (int y = y1; y <= y2; y++) {
-            int x_start = x1 + (y - y1) * inv_slope_1;
-            int x_end = x0 + (y - y0) * inv_slope_2;
-            
-            if (x_end < x_start) {
-                int_swap(&x_start, &x_end); // swap if x_start is to the right of x_end
-            }
-            
-            for (int x = x_start; x < x_end; x++) {
-                
-                // Draw our pixel with the color that comes from the texture
-                // Draw our pixel with the color that comes from the texture
-                draw_texel(x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv );
-            }
-            
+    // Divide only every few pixels when the depth range is small enough for the error to stay hidden
+    bool bilinear = (texture_filter == FILTER_BILINEAR);
+    textured_span_function_t kernel = bilinear ? draw_bilinear_span_kernel : draw_textured_span_kernel;
+    if (texture_method == TEXTURE_SUBDIVIDED) {
+        float w_min = fminf(vertices[0].w, fminf(vertices[1].w, vertices[2].w));
+        float w_max = fmaxf(vertices[0].w, fmaxf(vertices[1].w, vertices[2].w));
+        if (w_max <= w_min * SUBDIVIDE_MAX_W_RATIO) {
+            kernel = bilinear ? draw_bilinear_span_subdivided : draw_textured_span_subdivided;
         }
     }
     
+    // Values of the planes at x = 0 of the current row, stepped by the y deltas
+    float row_u = 0;
+    float row_v = 0;
+    float row_reciprocal_w = 0;
+    float row_intensity = 0;
+    
+    for (int y = raster.y_start; y <= raster.y_end; y++) {
+        if (y == raster.y_start || y % TILE_SIZE == 0) {
+            row_u = planes.u_over_w.origin + planes.u_over_w.dy * y;
+            row_v = planes.v_over_w.origin + planes.v_over_w.dy * y;
+            row_reciprocal_w = planes.reciprocal_w.origin + planes.reciprocal_w.dy * y;
+            row_intensity = planes.intensity_over_w.origin + planes.intensity_over_w.dy * y;
+        }
+        int x_start, x_end;
+        if (raster_row_span(&raster, y, clip, &x_start, &x_end)) {
+            draw_textured_span(y, x_start, x_end, row_u, row_v, row_reciprocal_w, row_intensity, shaded, &planes, &texture->levels[level], kernel, clip);
+        }
+        row_u += planes.u_over_w.dy;
+        row_v += planes.v_over_w.dy;
+        row_reciprocal_w += planes.reciprocal_w.dy;
+        row_intensity += planes.intensity_over_w.dy;
+    }
+}
+
+// Scratch arrays of the depth sort, grown to the largest frame and kept until free_sort_buffers
+static uint32_t* sort_key_buffer = NULL;    // two arrays of keys to ping-pong between
+static uint32_t* sort_order_buffer = NULL;  // the other array of indices
+static int sort_capacity = 0;
+
+// Map a float to an unsigned key with the same ordering (negative values flip all bits)
+static uint32_t float_sort_key(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x80000000) ? ~bits : (bits | 0x80000000);
 }
 
-// todo create implementation for triangle.h functions
+// Sort the triangle indices by avg_depth from the farthest to the closest
+///////////////////////////////////////////////////////////////////////////////
+// LSD radix sort over the exact float bits of avg_depth paired with the indices,
+// 4 passes of 8 bits and no triangle_t is ever moved. The sort is stable, so
+// triangles with the same depth keep the order they were submitted in.
+//
+void sort_triangles_back_to_front(const triangle_t* triangles, int num_triangles, uint32_t* order) {
+    if (num_triangles <= 0) {
+        return;
+    }
+    if (num_triangles > sort_capacity) {
+        sort_capacity = num_triangles;
+        sort_key_buffer = (uint32_t*) realloc(sort_key_buffer, sizeof(uint32_t) * 2 * sort_capacity);
+        sort_order_buffer = (uint32_t*) realloc(sort_order_buffer, sizeof(uint32_t) * sort_capacity);
+    }
+
+    uint32_t* src_keys = sort_key_buffer;
+    uint32_t* dst_keys = sort_key_buffer + sort_capacity;
+    uint32_t* src_order = order;
+    uint32_t* dst_order = sort_order_buffer;
+
+    // Keys are inverted so that an ascending sort gives the farthest triangles first
+    for (int i = 0; i < num_triangles; i++) {
+        src_keys[i] = ~float_sort_key(triangles[i].avg_depth);
+        src_order[i] = i;
+    }
+
+    for (int shift = 0; shift < 32; shift += 8) {
+        int offsets[256] = { 0 };
+        for (int i = 0; i < num_triangles; i++) {
+            offsets[(src_keys[i] >> shift) & 0xFF]++;
+        }
+        // Skip the pass when every key has the same byte
+        if (offsets[(src_keys[0] >> shift) & 0xFF] == num_triangles) {
+            continue;
+        }
+        int sum = 0;
+        for (int b = 0; b < 256; b++) {
+            int count = offsets[b];
+            offsets[b] = sum;
+            sum += count;
+        }
+        for (int i = 0; i < num_triangles; i++) {
+            int dst = offsets[(src_keys[i] >> shift) & 0xFF]++;
+            dst_keys[dst] = src_keys[i];
+            dst_order[dst] = src_order[i];
+        }
+        uint32_t* keys = src_keys;
+        src_keys = dst_keys;
+        dst_keys = keys;
+        uint32_t* indices = src_order;
+        src_order = dst_order;
+        dst_order = indices;
+    }
+
+    if (src_order != order) {
+        memcpy(order, src_order, sizeof(uint32_t) * num_triangles);
+    }
+}
+
+void free_sort_buffers(void) {
+    free(sort_key_buffer);
+    free(sort_order_buffer);
+    sort_key_buffer = NULL;
+    sort_order_buffer = NULL;
+    sort_capacity = 0;
+}
 
 
 
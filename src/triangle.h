@@ -2,6 +2,7 @@
 #define TRIANGLE_H
 
 #include <stdint.h>
+#include "display.h"
 #include "texture.h"
 #include "vector.h"
 
@@ -12,28 +13,55 @@ typedef struct {
     tex2_t a_uv;
     tex2_t b_uv;
     tex2_t c_uv;
+    int a_normal; // 1-based vn indices, 0 when the face has none
+    int b_normal;
+    int c_normal;
     uint32_t color;
 } face_t;
 
 typedef struct {
     vec4_t points[3];
     tex2_t texcoords[3];
+    float intensities[3]; // light intensity at each vertex for the Gouraud shading
     uint32_t color;
     float avg_depth;
+    uint32_t face; // mesh face the triangle was cut from
 } triangle_t;
 
+void sort_triangles_back_to_front(const triangle_t* triangles, int num_triangles, uint32_t* order);
+void free_sort_buffers(void);
+
 void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color);
+void draw_triangle_clipped(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color, clip_rect_t* clip);
 
-void draw_filled_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color);
+void draw_filled_triangle(
+    float x0, float y0, float z0, float w0,
+    float x1, float y1, float z1, float w1,
+    float x2, float y2, float z2, float w2,
+    uint32_t color
+);
+void draw_filled_triangle_clipped(
+    float x0, float y0, float z0, float w0,
+    float x1, float y1, float z1, float w1,
+    float x2, float y2, float z2, float w2,
+    uint32_t color, clip_rect_t* clip
+);
 
 
 
 // TODO: NNN
+// intensities holds the light intensity of the 3 vertices to shade the texels with, or is NULL
 void draw_textured_triangle(
-    int x0, int y0, float z0, float w0, float u0, float v0,
-    int x1, int y1, float z1, float w1, float u1, float v1,
-    int x2, int y2, float z2, float w2, float u2, float v2,
-    uint32_t* texture
+    float x0, float y0, float z0, float w0, float u0, float v0,
+    float x1, float y1, float z1, float w1, float u1, float v1,
+    float x2, float y2, float z2, float w2, float u2, float v2,
+    const float* intensities, const texture_t* texture
+);
+void draw_textured_triangle_clipped(
+    float x0, float y0, float z0, float w0, float u0, float v0,
+    float x1, float y1, float z1, float w1, float u1, float v1,
+    float x2, float y2, float z2, float w2, float u2, float v2,
+    const float* intensities, const texture_t* texture, clip_rect_t* clip
 );
 
 #endif